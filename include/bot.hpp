@@ -1,57 +1,94 @@
 #pragma once
 
+#include <filesystem>
+#include <future>
 #include <random>
-#include <dpp/cluster.h>
-
+#include <nlohmann/json.hpp>
+
+#include "interaction.h"
+#include "job_scheduler.h"
+#include "metrics.h"
+#include "png_encoder.h"
+#include "shader_parser.h"
+#include "texture_cache.h"
 #include "vulkan_backend.h"
 
 namespace vulkanbot {
 
-enum class shader_type {
-    vert, frag, comp, unknown
-};
-struct shader {
-    std::string data;
-    shader_type type;
-    bool file;
-};
-
-struct animation {
-	int frames;
-	int fps;
-	float tStart = 0.0;
-	float tEnd = 1.0;
-	long bitrate;
-};
+std::optional<std::filesystem::path> find_first_existing(std::initializer_list<std::filesystem::path> paths);
 
 class VulkanBot
 {
 public:
-    VulkanBot(const nlohmann::json& config);
-    void run();
+    VulkanBot(const nlohmann::json& config, std::shared_ptr<HttpClient> http);
+
+    // command is one of "render image", "render video" or "compute", content the message with the shaders
+    void handle_command(std::shared_ptr<Interaction> interaction, std::string command, const std::string& content,
+        const std::string& texture);
+
+    Metrics& get_metrics() { return metrics; }
 private:
 	std::vector<unsigned char> download_image(const std::string& url);
-
-    void do_compute(const dpp::interaction_create_t& event, const dpp::message& message, const shader& shader,
-		const std::string& texture);
-    void do_render(const dpp::interaction_create_t& event, const dpp::message& message, const shader& vertex, const shader& fragment,
-		const std::string& texture, std::optional<animation> animation = std::nullopt);
-	void do_render_animation_internal(const dpp::interaction_create_t& event, animation animation);
+	// downloads and decodes on the fetch workers, the result is nullptr if the texture cannot be decoded;
+	// dropping the future does not wait for the download
+	std::shared_future<std::shared_ptr<const DecodedTexture>> fetch_texture(const std::string& url);
+	// uploads the texture unless it already is on the GPU, and binds it to the context
+	std::shared_ptr<ImageData> bind_texture(RenderContext& context, std::shared_ptr<const DecodedTexture> texture);
+
+    void do_compute(Interaction& interaction, const shader& shader, const std::string& texture);
+    void do_render(Interaction& interaction, const shader& vertex, const shader& fragment,
+		const std::string& texture, int width, int height, std::optional<animation> animation = std::nullopt);
+	void do_render_animation_internal(Interaction& interaction, RenderContext& context, animation animation);
+	// renders a still at a fraction of the size with the pipeline and texture already bound to the context and sends it,
+	// unless that would take longer than the budget since the job started
+	void do_render_preview(Interaction& interaction, RenderContext& context, int width, int height, float time, float random,
+		std::chrono::steady_clock::time_point started);
+
+	void enqueue_job(std::shared_ptr<Interaction> interaction, JobPriority priority, std::function<void()> job);
+	// answers with the error and counts the job as failed
+	void fail(Interaction& interaction, const std::string& error);
+
+	// histogram of one stage of a job, like "compile" or "gpu"
+	Histogram& stage(const std::string& name);
+	// the GPU time of each pass, as gpu_shader, gpu_encode and gpu_readback
+	void observe_gpu(const GpuTimings& timings);
+	void register_metrics();
+
+	float next_random();
 
     void initVulkan(const nlohmann::json& config, const std::filesystem::path& shader_path, const std::filesystem::path& shader_include_path);
 
-    dpp::cluster bot;
+	std::shared_ptr<HttpClient> http;
 
+	// declared before everything that observes into it
+	Metrics metrics;
 	VulkanBackend backend;
+	// declared after the backend, so the textures are freed before it goes away
+	std::unique_ptr<TextureCache> texture_cache;
+	// downloads textures for the jobs, joined after the jobs that might wait for them and before the texture cache
+	std::unique_ptr<JobScheduler> fetch_scheduler;
+	// declared last of these, so the workers are joined before anything the jobs use goes away
+	std::unique_ptr<JobScheduler> scheduler;
 	std::random_device rd;
 	std::mt19937 e2;
 	std::uniform_real_distribution<> dist;
+	std::mutex random_lock;
 
 	bool m_renderProgress;
 	unsigned int m_renderProgressDelay;
 
+	// default size of the output, a message can ask for any size up to the maximum
 	int m_width;
 	int m_height;
+	int m_maxWidth;
+	int m_maxHeight;
+	PngCompression m_pngCompression;
+	unsigned int m_imageThreads;
+
+	// progressive delivery: a small preview goes out before the full result
+	bool m_preview = false;
+	int m_previewDivisor = 2;
+	double m_previewBudget = 1.5;
 
 	int m_defaultFrames;
 	int m_defaultFPS;
@@ -62,18 +99,14 @@ private:
 	int m_maxFrames;
 	long m_bitrate;
 	long m_maxBitrate;
-
-	struct animation_render_data {
-		shader vert;
-		shader frag;
-		std::string texture;
-		std::optional<std::string> mesh;
-		dpp::message_context_menu_t event;
-	};
-	unsigned long long int next_animation_id = 0;
-	std::map<unsigned long long int, animation_render_data> pending_animations;
-
-	std::mutex render_lock;
+	unsigned int m_videoThreads;
+	// MP4 frames with interleaved chroma, GIF and WebP have their own formats
+	bool m_nv12 = false;
+	// animated WebP is only there if FFmpeg has libwebp
+	bool m_webp = false;
+
+	// declared last, so it stops scraping before the stats it reads go away
+	std::unique_ptr<MetricsServer> metrics_server;
 };
 
 }
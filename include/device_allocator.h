@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace vulkanbot
+{
+	class DeviceAllocator;
+
+	// Linear pools only ever append to their blocks, which suits resources that live as long as the backend or a context.
+	// Free list pools reuse any gap, for resources that come and go.
+	enum class AllocationStrategy { Linear, FreeList };
+
+	// One vkAllocateMemory, host visible ones are mapped for as long as they exist.
+	struct MemoryBlock {
+		vk::UniqueDeviceMemory memory;
+		vk::DeviceSize size;
+		uint8_t* data = nullptr;
+		bool coherent = true;
+		bool dedicated = false;
+		size_t allocations = 0;
+		vk::DeviceSize used = 0;
+		// next offset of a linear block
+		vk::DeviceSize head = 0;
+		// offset and size of the gaps in a free list block
+		std::map<vk::DeviceSize, vk::DeviceSize> free;
+		// memory type, whether it holds images and strategy of the pool it belongs to
+		std::tuple<uint32_t, bool, AllocationStrategy> pool;
+	};
+
+	// A range of a block of device memory, it goes back to its pool when destroyed.
+	class Allocation
+	{
+		public:
+			Allocation() = default;
+			Allocation(Allocation&& other) noexcept;
+			Allocation& operator=(Allocation&& other) noexcept;
+			Allocation(const Allocation&) = delete;
+			Allocation& operator=(const Allocation&) = delete;
+			~Allocation();
+
+			vk::DeviceMemory memory() const { return m_block->memory.get(); }
+			vk::DeviceSize offset() const { return m_offset; }
+			vk::DeviceSize size() const { return m_size; }
+			// only for host visible memory
+			uint8_t* data() const { return m_block->data ? m_block->data + m_offset : nullptr; }
+			bool coherent() const { return m_block->coherent; }
+
+			// make GPU writes visible to the host, nothing to do for coherent memory
+			void invalidate() const;
+			// make host writes visible to the GPU, nothing to do for coherent memory
+			void flush() const;
+		private:
+			friend class DeviceAllocator;
+
+			DeviceAllocator* m_allocator = nullptr;
+			MemoryBlock* m_block = nullptr;
+			vk::DeviceSize m_offset = 0;
+			vk::DeviceSize m_size = 0;
+	};
+
+	// Sub-allocates buffers and images from large blocks of device memory, so a job does not cost a vkAllocateMemory for every
+	// resource and the number of allocations stays far below maxMemoryAllocationCount.
+	// There is a pool for every memory type, strategy and kind of resource, images and buffers never share a block so
+	// bufferImageGranularity does not matter. Resources larger than half a block get a block of their own.
+	// Every pool keeps one empty block around, others are freed as soon as they are empty, and so are dedicated ones.
+	// Thread safe, and it has to outlive all of its allocations.
+	class DeviceAllocator
+	{
+		public:
+			struct Stats {
+				// sub-allocations that are alive
+				uint64_t allocations;
+				// blocks of device memory that are alive, and how many were allocated so far
+				uint64_t blocks;
+				uint64_t blocksAllocated;
+				size_t reservedBytes;
+				size_t usedBytes;
+			};
+
+			DeviceAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize = 16*1024*1024);
+
+			// Allocates memory for the resource and binds it. Memory with the preferred properties as well is used if there is any.
+			Allocation allocate(vk::Buffer buffer, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred = {},
+				AllocationStrategy strategy = AllocationStrategy::FreeList);
+			Allocation allocate(vk::Image image, vk::MemoryPropertyFlags required,
+				AllocationStrategy strategy = AllocationStrategy::FreeList);
+
+			Stats stats() const;
+		private:
+			friend class Allocation;
+
+			Allocation allocate(const vk::MemoryRequirements& requirements, bool image, vk::MemoryPropertyFlags required,
+				vk::MemoryPropertyFlags preferred, AllocationStrategy strategy);
+			// the offset of a range of the given size in the block, if it fits
+			std::optional<vk::DeviceSize> place(MemoryBlock& block, vk::DeviceSize size, vk::DeviceSize alignment, AllocationStrategy strategy);
+			std::unique_ptr<MemoryBlock> createBlock(uint32_t memoryType, vk::DeviceSize size);
+			void free(Allocation& allocation);
+			// ranges in non-coherent memory cover whole atoms, so flushing or invalidating one never touches its neighbours
+			vk::MappedMemoryRange range(const Allocation& allocation) const;
+
+			vk::Device m_device;
+			vk::PhysicalDeviceMemoryProperties m_memoryProperties;
+			vk::DeviceSize m_nonCoherentAtomSize;
+			vk::DeviceSize m_blockSize;
+
+			mutable std::mutex m_mutex;
+			// by memory type, whether they hold images and strategy
+			std::map<std::tuple<uint32_t, bool, AllocationStrategy>, std::vector<std::unique_ptr<MemoryBlock>>> m_pools;
+			uint64_t m_allocations = 0;
+			uint64_t m_blocksAllocated = 0;
+	};
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <dpp/cluster.h>
+#include <nlohmann/json.hpp>
+
+#include "bot.hpp"
+#include "interaction.h"
+#include "interaction_record.h"
+
+namespace vulkanbot {
+
+// Connects a VulkanBot to Discord: registers the context menu commands and turns their events into Interactions.
+class DiscordFrontend
+{
+public:
+	DiscordFrontend(const nlohmann::json& config);
+
+	// fetches textures with the HTTP client of the cluster
+	std::shared_ptr<HttpClient> http_client();
+
+	// Returns once stop is set, no commands reach the bot after that. The cluster keeps running, so jobs that are still
+	// in progress can respond, until the frontend is destroyed.
+	void run(VulkanBot& bot, const std::atomic_bool& stop);
+private:
+	friend class DiscordInteraction;
+
+	void ask_animation(const dpp::interaction_create_t& event, RecordedInteraction request, const animation& defaults,
+		std::function<void(std::shared_ptr<Interaction>, animation)> answer);
+	// appends an accepted command to the recording, if there is one
+	void record(RecordedInteraction interaction);
+
+	dpp::cluster cluster;
+	// shared by the event handlers that pass commands on to the bot, exclusive for stopping them
+	std::shared_mutex handler_lock;
+	bool stopped = false;
+	// time from handing a response with attachments to dpp until Discord confirms it
+	Histogram* upload = nullptr;
+
+	struct pending_animation {
+		RecordedInteraction request;
+		animation defaults;
+		std::function<void(std::shared_ptr<Interaction>, animation)> answer;
+	};
+	std::mutex pending_lock;
+	unsigned long long int next_animation_id = 0;
+	std::map<unsigned long long int, pending_animation> pending_animations;
+
+	std::mutex record_lock;
+	std::ofstream recording;
+	std::chrono::steady_clock::time_point record_start;
+};
+
+}
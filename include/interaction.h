@@ -0,0 +1,55 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "shader_parser.h"
+
+namespace vulkanbot {
+
+struct Attachment {
+	std::string name;
+	std::string content;
+	std::string mimetype;
+};
+
+enum class JobState {
+	Queued,
+	Rejected,
+	Started,
+	Finished,
+};
+
+// A single request to the bot, answered by editing one response.
+// DiscordFrontend implements it on top of Discord interactions, vulkan_bot_replay with a local stand-in.
+class Interaction
+{
+public:
+	virtual ~Interaction() = default;
+
+	// answers right away, for requests that are rejected before they reach the queue
+	virtual void reply(const std::string& content) = 0;
+	// defers the response, it is filled in by edit_response later
+	virtual void thinking() = 0;
+	virtual void edit_response(const std::string& content, std::vector<Attachment> attachments = {}) = 0;
+
+	// asks for the settings of a video, the answer arrives as a new interaction
+	virtual void ask_animation(const animation& defaults, std::function<void(std::shared_ptr<Interaction>, animation)> answer) = 0;
+
+	// called as the job of this interaction moves through the scheduler, Started and Finished on the worker thread
+	virtual void job_state(JobState state) {}
+};
+
+// Fetches textures, through dpp for Discord or from local files for the stand-in.
+class HttpClient
+{
+public:
+	virtual ~HttpClient() = default;
+
+	// returns the response body, which is empty if the request failed
+	virtual std::string get(const std::string& url) = 0;
+};
+
+}
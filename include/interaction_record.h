@@ -0,0 +1,59 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <nlohmann/json.hpp>
+
+#include "shader_parser.h"
+
+namespace vulkanbot {
+
+// One line of a recording made by DiscordFrontend (config "debug": {"record": PATH}), played back by vulkan_bot_replay.
+struct RecordedInteraction {
+	// seconds since the recording started
+	double time = 0.0;
+	std::string command;
+	std::string content;
+	std::string texture;
+	// the settings from the dialog of "render video"
+	std::optional<animation> video;
+};
+
+inline void to_json(nlohmann::json& j, const RecordedInteraction& r)
+{
+	j = {
+		{"time", r.time},
+		{"command", r.command},
+		{"content", r.content},
+		{"texture", r.texture},
+	};
+	if(r.video) {
+		j["video"] = {
+			{"frames", r.video->frames},
+			{"fps", r.video->fps},
+			{"t_start", r.video->tStart},
+			{"t_end", r.video->tEnd},
+			{"format", r.video->format},
+		};
+	}
+}
+
+inline void from_json(const nlohmann::json& j, RecordedInteraction& r)
+{
+	r.time = j.value("time", 0.0);
+	r.command = j.at("command");
+	r.content = j.at("content");
+	r.texture = j.value("texture", "");
+	if(j.contains("video")) {
+		const nlohmann::json& video = j["video"];
+		r.video = animation{
+			.frames = video.at("frames").get<int>(),
+			.fps = video.at("fps").get<int>(),
+			.tStart = video.value("t_start", 0.0f),
+			.tEnd = video.value("t_end", 1.0f),
+			.format = video.value("format", "mp4"),
+		};
+	}
+}
+
+}
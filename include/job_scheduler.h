@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace vulkanbot
+{
+	// lower values run first
+	enum class JobPriority {
+		High = 0,	// images and compute
+		Low = 1,	// videos
+	};
+
+	// Runs jobs on a fixed number of worker threads, taking the oldest job of the highest priority first.
+	// At most maxQueued jobs wait at a time, submitting more than that is rejected instead of piling up.
+	class JobScheduler
+	{
+		public:
+			struct Stats {
+				size_t queued;
+				size_t running;
+				uint64_t completed;
+				uint64_t rejected;
+			};
+
+			JobScheduler(unsigned int workers, size_t maxQueued);
+			~JobScheduler();
+
+			// Returns the position in the queue (0 if a worker picks it up right away), or nothing if the queue is full.
+			std::optional<size_t> submit(JobPriority priority, std::function<void()> job);
+
+			Stats stats() const;
+		private:
+			void work();
+
+			size_t m_maxQueued;
+
+			mutable std::mutex m_mutex;
+			std::condition_variable m_condition;
+			std::array<std::deque<std::function<void()>>, 2> m_queues;
+			size_t m_queued = 0;
+			size_t m_idle;
+			uint64_t m_completed = 0;
+			uint64_t m_rejected = 0;
+			bool m_stop = false;
+			std::vector<std::thread> m_workers;
+	};
+}
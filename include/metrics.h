@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vulkanbot
+{
+	inline double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Cumulative histogram with fixed bucket bounds, observe is lock-free so it can be called from any thread.
+	class Histogram
+	{
+		public:
+			explicit Histogram(std::vector<double> bounds);
+
+			void observe(double seconds);
+			// the backend reports its timings in μs
+			void observeMicroseconds(long us) { observe(us / 1e6); }
+
+		private:
+			friend class Metrics;
+
+			std::vector<double> m_bounds;
+			// one per bound, plus the +Inf bucket
+			std::unique_ptr<std::atomic_uint64_t[]> m_buckets;
+			std::atomic<double> m_sum = 0.0;
+			std::atomic_uint64_t m_count = 0;
+	};
+
+	class Counter
+	{
+		public:
+			void add(uint64_t n = 1) { m_value += n; }
+
+		private:
+			friend class Metrics;
+
+			std::atomic_uint64_t m_value = 0;
+	};
+
+	// Registry of everything the bot measures, rendered in the Prometheus text format.
+	// Metrics with the same name form a family and differ by their labels, which are passed preformatted, like stage="compile".
+	// Registering the same name and labels again returns the existing metric.
+	class Metrics
+	{
+		public:
+			Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = {});
+			Counter& counter(const std::string& name, const std::string& help, const std::string& labels = {});
+			// read on every scrape, for values that are already tracked elsewhere
+			void counter(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> value);
+			void gauge(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> value);
+
+			std::string render() const;
+
+			// from 0.5 ms to 2 minutes, which covers everything from a cached compile to a long video
+			static const std::vector<double> defaultBounds;
+
+		private:
+			struct Family {
+				std::string type;
+				std::string help;
+				std::map<std::string, std::unique_ptr<Histogram>> histograms;
+				std::map<std::string, std::unique_ptr<Counter>> counters;
+				std::map<std::string, std::function<double()>> callbacks;
+			};
+			Family& family(const std::string& name, const std::string& type, const std::string& help);
+
+			mutable std::mutex m_mutex;
+			std::map<std::string, Family> m_families;
+	};
+
+	// Serves Metrics::render as GET /metrics over plain HTTP on its own thread, meant for a local scraper.
+	class MetricsServer
+	{
+		public:
+			MetricsServer(const Metrics& metrics, const std::string& address, uint16_t port);
+			~MetricsServer();
+
+		private:
+			void serve();
+
+			const Metrics& m_metrics;
+			int m_socket = -1;
+			std::atomic_bool m_stop = false;
+			std::thread m_thread;
+	};
+
+	// resident set size of this process in bytes, 0 if it cannot be read
+	size_t residentMemory();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace vulkanbot
+{
+	enum class PngCompression {
+		Fast,
+		Default,
+		Max,
+	};
+	std::optional<PngCompression> parsePngCompression(const std::string& name);
+
+	// Encodes 8 bit RGBA pixels as PNG, reading them straight from the given memory.
+	// Rows are filtered and deflated in independent chunks on multiple threads, the chunks are then stitched into a single zlib stream.
+	// threads = 0 uses one thread per core.
+	std::string encodePng(const uint8_t* rgba, uint32_t width, uint32_t height,
+		PngCompression compression = PngCompression::Default, unsigned int threads = 0);
+}
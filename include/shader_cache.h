@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glslang/Public/ShaderLang.h>
+
+namespace vulkanbot
+{
+	// Content-addressed cache for compiled SPIR-V.
+	// Entries are keyed by a SHA-256 over the stage, the normalized source and every file it includes,
+	// kept in an in-memory LRU and optionally persisted as <key>.spv files in a directory. Once the files take more than
+	// maxDiskBytes, storing removes the ones that were least recently written or read, by their modification time.
+	class ShaderCache
+	{
+		public:
+			struct Stats {
+				uint64_t memoryHits;
+				uint64_t diskHits;
+				uint64_t misses;
+				size_t entries;
+				size_t bytes;
+			};
+
+			ShaderCache(std::optional<std::filesystem::path> directory = std::nullopt, size_t maxMemoryBytes = 16*1024*1024,
+				size_t maxDiskBytes = 256*1024*1024);
+
+			std::string key(EShLanguage stage, const std::string& source, const std::filesystem::path& includePath) const;
+
+			bool lookup(const std::string& key, std::vector<unsigned int>& spirv);
+			void store(const std::string& key, const std::vector<unsigned int>& spirv);
+
+			Stats stats() const;
+		private:
+			void insert(const std::string& key, const std::vector<unsigned int>& spirv);
+			// with m_diskMutex held, removes the oldest files until the directory is within m_maxDiskBytes again
+			void evictFiles(const std::filesystem::path& keep);
+
+			std::optional<std::filesystem::path> m_directory;
+			size_t m_maxMemoryBytes;
+			size_t m_maxDiskBytes;
+
+			// separate from m_mutex, so lookups in memory do not wait for the directory to be cleaned up
+			std::mutex m_diskMutex;
+			size_t m_diskBytes = 0;
+
+			mutable std::mutex m_mutex;
+			std::list<std::pair<std::string, std::vector<unsigned int>>> m_entries;
+			std::unordered_map<std::string, decltype(m_entries)::iterator> m_index;
+			size_t m_bytes = 0;
+
+			uint64_t m_memoryHits = 0;
+			uint64_t m_diskHits = 0;
+			uint64_t m_misses = 0;
+	};
+}
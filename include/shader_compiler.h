@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glslang/Public/ShaderLang.h>
+
+#include "shader_cache.h"
+
+namespace vulkanbot
+{
+	struct CompileResult {
+		bool success;
+		std::string error;
+		std::vector<unsigned int> spirv;
+	};
+
+	// Compiles GLSL to SPIR-V on a pool of worker threads.
+	// glslang is set up once per process by the first compiler and torn down at exit, any number of instances can exist.
+	class ShaderCompiler
+	{
+		public:
+			ShaderCompiler(const std::filesystem::path& includePath, std::unique_ptr<ShaderCache> cache, unsigned int threads = 0);
+			~ShaderCompiler();
+
+			std::future<CompileResult> compile(EShLanguage stage, std::string source);
+
+			ShaderCache::Stats cacheStats() const;
+		private:
+			CompileResult compileNow(EShLanguage stage, const std::string& source);
+			void work();
+
+			std::filesystem::path m_includePath;
+			std::unique_ptr<ShaderCache> m_cache;
+
+			std::mutex m_mutex;
+			std::condition_variable m_condition;
+			std::queue<std::function<void()>> m_tasks;
+			bool m_stop = false;
+			std::vector<std::thread> m_workers;
+	};
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vulkanbot {
+
+enum class shader_type {
+    vert, frag, comp, unknown
+};
+struct shader {
+    std::string data;
+    shader_type type;
+    bool file;
+};
+
+struct animation {
+	int frames;
+	int fps;
+	float tStart = 0.0;
+	float tEnd = 1.0;
+	long bitrate = 0;
+	// container of the video: mp4, gif or webp
+	std::string format = "mp4";
+};
+
+// Finds the shaders in a message: ```code blocks``` with their source, or ``name`` for a shader that ships with the bot.
+// The type is taken from a vert/frag/comp prefix, a file extension or guessed from the code, default_type otherwise.
+std::vector<shader> find_shaders(const std::string& message, shader_type default_type = shader_type::frag);
+// Reads an "animated <frames> <fps> [<t start> <t end> [<bitrate>]]" line, like the ones in examples/.
+// The bitrate may end in k or M, it is 0 if not given.
+std::optional<animation> find_animation(const std::string& message);
+// Reads a "size <width>x<height>" line, for output in another size than the default one.
+std::optional<std::pair<int, int>> find_size(const std::string& message);
+
+}
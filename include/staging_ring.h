@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "device_allocator.h"
+
+namespace vulkanbot
+{
+	// A persistently mapped, host coherent buffer every upload copies its data through, instead of creating and mapping a
+	// buffer of its own each time. Regions are handed out in order and reclaimed in the same order once the fence of the
+	// submission that read them is signaled, which is checked whenever a region is acquired or released, so nobody has to
+	// wait for their uploads. Regions larger than the whole ring get a temporary buffer of their own.
+	// Thread safe, acquire blocks while the ring is full.
+	class StagingRing
+	{
+		public:
+			struct Region {
+				vk::Buffer buffer;
+				vk::DeviceSize offset;
+				vk::DeviceSize size;
+				uint8_t* data;
+				// to be passed to the submission that reads the region, it is reclaimed once that signals it
+				vk::Fence fence;
+				uint64_t id;
+			};
+
+			struct Stats {
+				vk::DeviceSize size;
+				// of regions that were not reclaimed yet
+				vk::DeviceSize usedBytes;
+				// times acquire had to wait for a submission to finish, and regions that did not fit into the ring at all
+				uint64_t waits;
+				uint64_t oversized;
+			};
+
+			StagingRing(DeviceAllocator& allocator, vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize size);
+
+			Region acquire(vk::DeviceSize size);
+			// submitted is false if the region was given up without submitting anything that reads it
+			void release(const Region& region, bool submitted = true);
+			// blocks until the submission that read the released region is done, for reusing what was submitted with it
+			void wait(const Region& region);
+
+			Stats stats() const;
+		private:
+			struct Entry {
+				uint64_t id;
+				vk::DeviceSize begin;
+				vk::DeviceSize end;
+				vk::Fence fence;
+				bool released = false;
+				bool submitted = false;
+				// only for oversized regions
+				vk::UniqueBuffer buffer;
+				Allocation allocation;
+			};
+
+			// with m_mutex held, the offset of a region of the given size in the ring if it fits right now
+			std::optional<vk::DeviceSize> fit(vk::DeviceSize size) const;
+			// with m_mutex held, drops the regions from the front whose submissions are done
+			void reclaim();
+			vk::Fence takeFence();
+
+			DeviceAllocator& m_allocator;
+			vk::Device m_device;
+			vk::DeviceSize m_alignment;
+
+			vk::UniqueBuffer m_buffer;
+			Allocation m_allocation;
+			vk::DeviceSize m_size;
+
+			mutable std::mutex m_mutex;
+			std::condition_variable m_released;
+			// in the order they were acquired
+			std::deque<std::unique_ptr<Entry>> m_entries;
+			// where the next region goes, only meaningful while there are regions in the ring
+			vk::DeviceSize m_head = 0;
+			std::vector<vk::UniqueFence> m_fences;
+			std::vector<vk::Fence> m_idleFences;
+			uint64_t m_nextId = 0;
+			uint64_t m_waits = 0;
+			uint64_t m_oversized = 0;
+	};
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace vulkanbot
+{
+	struct ImageData;
+
+	struct DecodedTexture {
+		uint32_t width;
+		uint32_t height;
+		std::vector<unsigned char> pixels;
+		// SHA-256 over the size and pixels, used as the key for the resident images
+		std::string hash;
+	};
+
+	// Two level cache for textures.
+	// Decoded RGBA pixels are kept by URL, so a repeated request skips the download and decode.
+	// Uploaded images are kept by content hash, so the same pixels are only ever uploaded once, no matter where they came from.
+	// Both levels are LRUs bounded by bytes.
+	class TextureCache
+	{
+		public:
+			struct Stats {
+				uint64_t decodedHits;
+				uint64_t decodedMisses;
+				uint64_t residentHits;
+				uint64_t residentMisses;
+				size_t decodedEntries;
+				size_t decodedBytes;
+				size_t residentEntries;
+				size_t residentBytes;
+			};
+
+			TextureCache(size_t maxDecodedBytes = 64*1024*1024, size_t maxResidentBytes = 256*1024*1024);
+
+			std::shared_ptr<const DecodedTexture> findDecoded(const std::string& url);
+			std::shared_ptr<const DecodedTexture> storeDecoded(const std::string& url, uint32_t width, uint32_t height, std::vector<unsigned char> pixels);
+
+			std::shared_ptr<ImageData> findResident(const std::string& hash);
+			void storeResident(const std::string& hash, std::shared_ptr<ImageData> image, size_t bytes);
+
+			Stats stats() const;
+		private:
+			template<typename T>
+			struct Lru {
+				std::list<std::tuple<std::string, T, size_t>> entries;
+				std::unordered_map<std::string, typename decltype(entries)::iterator> index;
+				size_t bytes = 0;
+				size_t maxBytes;
+
+				const T* find(const std::string& key);
+				void insert(const std::string& key, T value, size_t size);
+			};
+
+			mutable std::mutex m_mutex;
+			Lru<std::shared_ptr<const DecodedTexture>> m_decoded;
+			Lru<std::shared_ptr<ImageData>> m_resident;
+
+			uint64_t m_decodedHits = 0;
+			uint64_t m_decodedMisses = 0;
+			uint64_t m_residentHits = 0;
+			uint64_t m_residentMisses = 0;
+	};
+}
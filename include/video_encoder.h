@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <codeccontext.h>
+#include <dictionary.h>
+#include <formatcontext.h>
+
+namespace vulkanbot
+{
+	struct MemoryOutput;
+
+	// Encodes the frames from RenderContext::renderFrames into a video: YUV 4:2:0, planar or NV12, or palette indices for GIF.
+	// With more than one thread a video (other than GIF and WebP) is cut into segments of whole GOPs, each one encoded by its
+	// own encoder instance on a worker thread and muxed in order. Every segment starts with a keyframe and B-frames are turned
+	// off, so the decode order of the concatenated packets stays monotonic across the cuts.
+	class VideoEncoder
+	{
+		public:
+			// writes a file, the container is picked by the file extension
+			VideoEncoder(const std::string& path, int width, int height, int fps, long bitrate, unsigned int threads = 1, bool nv12 = false);
+			// Writes into memory, the video is handed over by takeData after finish. The container is mp4, gif or webp (animated),
+			// MP4 is fragmented, so it streams out front to back without seeking back to patch the index.
+			VideoEncoder(int width, int height, int fps, long bitrate, const std::string& container = "mp4", unsigned int threads = 1, bool nv12 = false);
+			~VideoEncoder();
+
+			// whether libav has an encoder for the container, animated WebP needs FFmpeg built with libwebp
+			static bool supports(const std::string& container);
+
+			// Frames have to be passed in order. The data is referenced instead of copied, it is released once libav is done with it.
+			// Blocks while the segment encoders are too far behind, so the readback buffers they hold on to stay bounded.
+			void encode(int frame, std::shared_ptr<uint8_t> data, size_t size);
+			// flushes the encoder and writes the trailer
+			void finish();
+			std::string takeData();
+			// the colors of the indices of GIF frames as 0xAARRGGBB, has to be set before the first frame
+			void setPalette(const std::array<uint32_t, 256>& palette);
+
+			// the rows of the frames are padded to this many bytes, like yuvRowAlignment of the backend
+			static constexpr int rowAlignment = 32;
+			static constexpr int gopSize = 10;
+			// frames per segment, short segments spread a job over the threads with little buffering, but every one restarts rate control
+			static constexpr int segmentFrames = 2*gopSize;
+		private:
+			struct Segment {
+				std::optional<av::VideoEncoderContext> encoder;
+				std::deque<av::VideoFrame> frames;
+				std::vector<av::Packet> packets;
+				// no more frames will be added
+				bool closed = false;
+				bool busy = false;
+				bool done = false;
+			};
+
+			void open(long bitrate, unsigned int threads, bool nv12);
+			// last thing the constructors do, once nothing that could throw is left, so no running worker outlives a failed construction
+			void startWorkers();
+			// threads is the encoder's own thread count, 0 lets libav pick; segment encoders get one each, the segments are the parallelism
+			av::VideoEncoderContext createEncoder(int maxBFrames, int threads) const;
+			void writeHeader(av::Dictionary options);
+			void write(av::Packet& packet);
+
+			void work();
+			Segment* nextSegment();
+			// muxes the finished segments at the front, unlocks while writing
+			void writeSegments(std::unique_lock<std::mutex>& lock);
+			void stop();
+
+			int m_width;
+			int m_height;
+			av::Rational m_timebase;
+			av::PixelFormat m_pixelFormat;
+			std::array<uint32_t, 256> m_palette{};
+			long m_bitrate = 0;
+			std::string m_container;
+
+			// declared before the context, which writes into it until it is closed
+			std::unique_ptr<MemoryOutput> m_memory;
+			av::OutputFormat m_format;
+			av::FormatContext m_context;
+			// encodes everything with a single thread, otherwise only sets up the stream
+			av::VideoEncoderContext m_encoder;
+
+			std::mutex m_mutex;
+			std::condition_variable m_condition;
+			std::map<int, Segment> m_segments;
+			size_t m_buffered = 0;
+			size_t m_maxBuffered = 0;
+			// workers that encode segments, none if the video is encoded in one piece
+			unsigned int m_segmentThreads = 0;
+			bool m_stop = false;
+			std::exception_ptr m_error;
+			std::vector<std::thread> m_workers;
+	};
+}
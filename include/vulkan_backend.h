@@ -1,11 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <bits/stdint-uintn.h>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <functional>
 #include <tuple>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
@@ -14,9 +20,10 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-#include <glslang/Public/ResourceLimits.h>
-#include <glslang/Public/ShaderLang.h>
-#include <glslang/SPIRV/GlslangToSpv.h>
+#include "device_allocator.h"
+#include "shader_cache.h"
+#include "shader_compiler.h"
+#include "staging_ring.h"
 
 namespace vulkanbot
 {
@@ -70,10 +77,12 @@ namespace vulkanbot
 	struct ImageData {
 		vk::Format format;
 		vk::UniqueImage image;
-		vk::UniqueDeviceMemory deviceMemory;
+		Allocation allocation;
 		vk::UniqueImageView imageView;
+		// of the allocation, which can be more than the pixels take
+		vk::DeviceSize size;
 
-		ImageData(	vk::PhysicalDevice const & physicalDevice,
+		ImageData(	DeviceAllocator & allocator,
 					vk::UniqueDevice const & device,
 					vk::Format format_,
 					vk::Extent2D const & extent,
@@ -87,10 +96,12 @@ namespace vulkanbot
 		vk::UniqueBuffer texCoordBuffer;
 		vk::UniqueBuffer normalBuffer;
 
-		vk::UniqueDeviceMemory memory;
+		Allocation vertexMemory;
+		Allocation texCoordMemory;
+		Allocation normalMemory;
 
 		vk::UniqueBuffer indexBuffer;
-		vk::UniqueDeviceMemory indexMemory;
+		Allocation indexMemory;
 
 		int vertexCount;
 		int indexCount;
@@ -125,103 +136,399 @@ namespace vulkanbot
 			return {0, 0, 0};
 		}
 
-		Mesh(	vk::PhysicalDevice const & physicalDevice,
+		Mesh(	DeviceAllocator & allocator,
 				vk::UniqueDevice const & device,
 				int const vertexCount, int const indexCount);
 	};
 
-	class VulkanBackend
+	struct PipelineCacheStats {
+		size_t loadedBytes;
+		size_t savedBytes;
+		uint64_t pipelinesCreated;
+		uint64_t saves;
+		uint64_t resets;
+	};
+
+	// A pipeline that was built without a render context, so it can be prepared before one is available.
+	struct PipelineResult {
+		bool success;
+		std::string error;
+		vk::UniquePipeline pipeline;
+		// drawn as a single triangle without vertex buffers, because it uses the default vertex stage
+		bool fullscreen = false;
+
+		// in μs, compiling (or loading) the shaders and creating the pipeline from them
+		long compileTime = 0;
+		long pipelineTime = 0;
+	};
+
+	// GPU time of the passes of one frame in μs, from timestamp queries around them.
+	// measured is false if the graphics queue does not support timestamps, all times are 0 then.
+	struct GpuTimings {
+		bool measured = false;
+		// the render pass with the user's shaders, or the dispatch of a compute shader
+		double shader = 0.0;
+		// conversion of a video frame to YUV or palette indices, straight into the readback (or staging) buffer
+		double encode = 0.0;
+		// copies of an RGBA frame into the readback (or staging) buffer
+		double readback = 0.0;
+	};
+
+	// What a frame is read back as. Images are RGBA, video frames are converted on the GPU: to YUV 4:2:0 for the video
+	// encoders, planar or with interleaved chroma, or to indices into paletteColors for GIF.
+	enum class FrameFormat { RGBA, YUV420P, NV12, PAL8 };
+
+	// Where the planes of a frame are, relative to its start in the readback buffer. The rows of video frames are padded to
+	// frameRowAlignment bytes, which is the layout av_image_fill_arrays gives their libav pixel formats with the same alignment,
+	// so the encoder can use the memory as it is. Odd sizes round the chroma planes up. RGBA frames are tightly packed.
+	struct FrameLayout {
+		// of the only plane for RGBA and PAL8, of the luma plane otherwise
+		uint32_t stride;
+		uint32_t chromaStride;
+		// U and V for planar frames, NV12 only uses the first one
+		std::array<uint32_t, 2> chromaOffset;
+		vk::DeviceSize size;
+	};
+	constexpr uint32_t frameRowAlignment = 32;
+	FrameLayout frameLayout(FrameFormat format, uint32_t width, uint32_t height);
+	// The fixed palette of PAL8 frames as 0xAARRGGBB, like libav's pal8: 6x7x6 levels of red, green and blue.
+	// The unused entries at the end are transparent, so the GIF encoder can use one of them to leave out unchanged pixels.
+	std::array<uint32_t, 256> paletteColors();
+
+	// The color and depth attachments of one size, shared by all contexts through VulkanBackend's frame pool.
+	struct RenderTarget {
+		vk::Extent2D extent;
+		std::unique_ptr<ImageData> color;
+		std::unique_ptr<ImageData> depth;
+		vk::UniqueFramebuffer framebuffer;
+
+		bool busy = false;
+		std::chrono::steady_clock::time_point lastUsed;
+	};
+
+	// A buffer frames are written to, from VulkanBackend's frame pool. Host buffers are the persistently mapped readback buffers,
+	// the others only exist with a dedicated transfer queue, as the device local staging buffers it copies from.
+	struct PooledBuffer {
+		vk::UniqueBuffer buffer;
+		Allocation memory;
+		vk::DeviceSize size;
+		bool host;
+		uint8_t* data = nullptr;
+
+		// cleared by whoever is done with the buffer, which can be the consumer of the frames long after the context is
+		std::atomic_bool busy = false;
+		// when it was last acquired, releasing does not take the lock of the pool
+		std::chrono::steady_clock::time_point lastUsed;
+	};
+
+	struct FramePoolStats {
+		size_t busyBytes;
+		size_t idleBytes;
+		uint64_t created;
+		uint64_t evicted;
+	};
+
+	class VulkanBackend;
+
+	// Everything a single job renders with: descriptor sets, uniform ring, command buffers and fences.
+	// The attachments and readback buffers come from the frame pool of the backend once the context renders at a given size.
+	// A context is only ever used by one thread at a time, acquire one with VulkanBackend::acquireContext.
+	class RenderContext
 	{
 		public:
-			~VulkanBackend();
+			RenderContext(VulkanBackend& backend, int index, int framesInFlight, int batchSize);
 
-			void initVulkan(int width, int height, 
-				const std::filesystem::path& shadersPath, const std::filesystem::path& shaderIncludePath,
-				bool validation = false, int debugSeverity = 0, int debugType = 0);
+			int index() const { return m_index; }
+
+			// size of the frames rendered from now on, the context goes back to the default size of the backend once released
+			void setExtent(uint32_t width, uint32_t height);
+			uint32_t width() const { return m_width; }
+			uint32_t height() const { return m_height; }
 
 			std::tuple<bool, std::string> uploadShaderMix(const std::string vertex, bool vertexFile, const std::string fragment, bool fragmentFile,
 				vk::CullModeFlags cullMode = vk::CullModeFlagBits::eFront, bool depth = true);
 			std::tuple<bool, std::string> uploadComputeShader(const std::string compute, bool file);
+			// fullscreen pipelines draw a single triangle instead of the mesh passed to buildCommandBuffer
+			void usePipeline(vk::UniquePipeline pipeline, bool fullscreen = false);
+			void useComputePipeline(vk::UniquePipeline pipeline);
 
-			void buildCommandBuffer(Mesh* mesh = nullptr, bool yuv420p = false);
+			void buildCommandBuffer(Mesh* mesh = nullptr, FrameFormat format = FrameFormat::RGBA);
 			void buildComputeCommandBuffer(int x, int y, int z);
 
+			// uploads and binds the image as texture
 			std::unique_ptr<ImageData> uploadImage(int width, int height, const std::vector<unsigned char>& data);
+			// binds an image that is already on the device, it has to stay alive until the context is done rendering
+			void bindImage(const ImageData& image);
+
+			void setUniformObject(const UniformBufferObject& ubo);
+
+			// The frames are in the format passed to buildCommandBuffer.
+			// The long passed to the consumers is the time spent waiting for the GPU in μs, the GpuTimings what the GPU spent on each pass.
+			void renderFrame(std::function<void(uint8_t*, vk::DeviceSize, int, int, vk::Result, long, const GpuTimings&)> consumer);
+			// Renders in batches of m_batchSize frames per submission.
+			// The data passed to the consumer stays valid (and its readback buffer reserved) as long as a copy of the pointer is alive.
+			void renderFrames(int count, std::function<void(int, UniformBufferObject*)> updater,
+				std::function<void(int, std::shared_ptr<uint8_t>, vk::DeviceSize, int, int, vk::Result, long, const GpuTimings&)> consumer);
+			void doComputation(std::function<void(OutputStorageObject*, vk::Result, long, const GpuTimings&)> consumer);
+		private:
+			friend class VulkanBackend;
+
+			VulkanBackend& m_backend;
+			const vk::UniqueDevice& m_device;
+			vk::PhysicalDevice m_physicalDevice;
+			int m_index;
+
+			uint32_t m_width;
+			uint32_t m_height;
+
+			// the attachments for the current size, taken from the pool on the first frame rendered at it
+			RenderTarget* m_target = nullptr;
+			RenderTarget& target();
+			void invalidateReadback(PooledBuffer* readback);
+			// Waits for whatever a job that was cut short left on the GPU and gives the target and buffers back to the pool.
+			// Called by the backend when the context goes back to it.
+			void release();
+
+			struct FrameSlot {
+				vk::UniqueCommandBuffer commandBuffer;
+				vk::UniqueFence fence;
+
+				PooledBuffer* readback = nullptr;
+				int frame = -1;
+				int frameCount = 0;
+
+				// only with a dedicated transfer queue, which moves the frames from the staging buffer to the readback buffer
+				vk::UniqueCommandBuffer transferCommandBuffer;
+				vk::UniqueSemaphore rendered;
+				PooledBuffer* staging = nullptr;
+
+				// the YUV conversion reads the render image and writes into the buffer the copies would go to,
+				// both change with the size and the readback buffer
+				vk::UniqueDescriptorSet encodeDescriptorSet;
+			};
+			// takes the readback (and staging) buffers of the batch from the pool
+			void acquireBuffers(FrameSlot& slot, vk::DeviceSize size);
+			void recordCommandBuffer(FrameSlot& slot, size_t slotIndex, vk::DeviceSize frameSize);
+			// submits the recorded batch, the fence of the slot is signaled once its frames are in the readback buffer
+			void submitFrames(FrameSlot& slot);
+
+			uint32_t uniformOffset(size_t slotIndex, int frame) const;
+			UniformBufferObject* uniformObject(size_t slotIndex, int frame);
+
+			// timestamps before the render pass and after the render pass, the encode dispatch and the copies of every frame,
+			// followed by two around the compute dispatch
+			static constexpr uint32_t timestampsPerFrame = 4;
+			uint32_t timestampIndex(size_t slotIndex, int frame) const;
+			uint32_t computeTimestampIndex() const;
+			// count consecutive timestamps from first, after the fence of their submission
+			std::vector<uint64_t> readTimestamps(uint32_t first, uint32_t count);
+			// timings of the given frame of a batch from its timestamps, unmeasured if there are none
+			GpuTimings frameTimings(const std::vector<uint64_t>& timestamps, int frame) const;
+			vk::UniqueQueryPool m_queryPool;
+
+			vk::UniqueFence m_fence;
+			vk::UniqueSemaphore m_uploadSemaphore;
+
+			vk::UniqueCommandPool m_commandPool;
+			vk::UniqueCommandPool m_transferCommandPool;
+			vk::UniqueCommandBuffer m_computeCommandBuffer;
+			// recorded again for every upload, the second one only acquires the resources on the graphics queue
+			vk::UniqueCommandBuffer m_uploadCommandBuffer;
+			vk::UniqueCommandBuffer m_uploadAcquireCommandBuffer;
+			std::optional<StagingRing::Region> m_lastUpload;
+
+			// ring of frame batches that can be in flight at the same time, m_frames[0] is used for single frames
+			std::vector<FrameSlot> m_frames;
+			int m_batchSize = 1;
+
+			Mesh* m_mesh = nullptr;
+			FrameFormat m_format = FrameFormat::RGBA;
+			FrameLayout m_layout;
+
+			vk::UniqueBuffer m_uniformBuffer;
+			Allocation m_uniformMemory;
+			vk::DeviceSize m_uniformStride;
+
+			vk::UniqueBuffer m_outputStorageBuffer;
+			Allocation m_outputStorageMemory;
+
+			vk::UniqueDescriptorPool m_descriptorPool;
+			vk::UniqueDescriptorSet m_descriptorSet;
+			vk::UniqueDescriptorSet m_computeDescriptorSet;
+
+			vk::UniquePipeline m_pipeline;
+			bool m_fullscreen = false;
+			vk::UniquePipeline m_computePipeline;
+
+	};
+
+	class VulkanBackend
+	{
+		public:
+			~VulkanBackend();
+
+			void initVulkan(int width, int height, int contexts, int framesInFlight, int batchSize,
+				const std::filesystem::path& shadersPath, const std::filesystem::path& shaderIncludePath,
+				bool validation = false, int debugSeverity = 0, int debugType = 0);
+
+			// Blocks until a render context is idle, it goes back to the pool when the last copy of the pointer is gone.
+			std::shared_ptr<RenderContext> acquireContext();
+			size_t contextCount() const { return m_contexts.size(); }
+
+			std::string deviceName() const;
+
+			// Compile the shaders and build the pipeline without holding a context, pass the result to RenderContext::usePipeline.
+			PipelineResult createShaderMixPipeline(const std::string& vertex, bool vertexFile, const std::string& fragment, bool fragmentFile,
+				vk::CullModeFlags cullMode = vk::CullModeFlagBits::eFront, bool depth = true);
+			PipelineResult createComputeShaderPipeline(const std::string& compute, bool file);
+
+			// must be called before initVulkan
+			void initShaderCache(std::optional<std::filesystem::path> directory, size_t maxMemoryBytes, size_t maxDiskBytes);
+			void configureShaderCompiler(unsigned int threads);
+			ShaderCache::Stats shaderCacheStats() const;
+
+			// must be called before initVulkan, the cache is saved every saveInterval if it changed and when the backend is destroyed
+			void configurePipelineCache(std::optional<std::filesystem::path> path, size_t maxBytes, std::chrono::seconds saveInterval);
+			void savePipelineCache();
+			PipelineCacheStats pipelineCacheStats() const;
+
+			// must be called before initVulkan, bytes of idle render targets and buffers that are kept for later jobs
+			void configureFramePool(size_t idleBytes);
+			FramePoolStats framePoolStats() const;
+
+			// must be called before initVulkan, size of the ring every upload is staged through
+			void configureStaging(vk::DeviceSize bytes);
+			DeviceAllocator::Stats allocatorStats() const;
+			StagingRing::Stats stagingStats() const;
+
 			std::unique_ptr<Mesh> uploadMesh(	std::vector<glm::vec3> vertices,
 												std::vector<glm::vec2> texCoords,
 												std::vector<glm::vec3> normals,
 												std::vector<uint16_t> indices);
-
-			void updateUniformObject(std::function<void(UniformBufferObject*)> updater);
-
-			void renderFrame(std::function<void(uint8_t*, vk::DeviceSize, int, int, vk::Result, long)> consumer, bool yuv420p = false);
-			void doComputation(std::function<void(OutputStorageObject*, vk::Result, long)> consumer);
 		private:
+			friend class RenderContext;
+
 			uint32_t m_width = 1024;
 			uint32_t m_height = 1024;
 
 			std::filesystem::path m_shadersPath;
 			std::filesystem::path m_shaderIncludePath;
 
+			std::unique_ptr<ShaderCache> m_shaderCache = std::make_unique<ShaderCache>();
+			unsigned int m_compilerThreads = 0;
+			std::unique_ptr<ShaderCompiler> m_compiler;
+
 			vk::UniqueShaderModule createShader(const std::vector<unsigned int>& code);
 			vk::UniqueShaderModule createShader(const std::vector<char>& code);
 			vk::UniquePipeline createPipeline(vk::UniqueShaderModule& vertexShader, vk::UniqueShaderModule& fragment,
-				vk::CullModeFlags cullMode = vk::CullModeFlagBits::eFront, bool depth = true);
+				vk::CullModeFlags cullMode = vk::CullModeFlagBits::eFront, bool depth = true, bool fullscreen = false);
 			vk::UniquePipeline createComputePipeline(vk::UniqueShaderModule& computeShader);
 
+			void loadPipelineCache();
+			void pipelineCreated();
+
+			// vk::Queue is externally synchronized, every context submits through here
+			void submit(const vk::SubmitInfo& submitInfo, vk::Fence fence);
+			// goes to the graphics queue if there is no dedicated transfer queue
+			void submitTransfer(const vk::SubmitInfo& submitInfo, vk::Fence fence);
+			// Records the copies from the staging region with record and runs them on the transfer queue. Returns right after
+			// submitting, the ring reclaims the region once the copies are done, and every later graphics submission sees the results.
+			// The region goes back to the ring even if recording fails.
+			// The barriers describe how the copied resources are used afterwards, with a dedicated transfer queue
+			// they also move the resources over to the graphics queue family.
+			// The command buffers are still in use by the previous upload that went through them, lastUpload, which is waited for first.
+			void upload(vk::CommandBuffer transferCommandBuffer, vk::CommandBuffer acquireCommandBuffer, vk::Semaphore semaphore,
+				std::optional<StagingRing::Region>& lastUpload, const StagingRing::Region& staging, const std::function<void(vk::CommandBuffer)>& record, vk::PipelineStageFlags dstStage,
+				std::vector<vk::BufferMemoryBarrier> bufferBarriers, std::vector<vk::ImageMemoryBarrier> imageBarriers);
+
 			vk::UniqueInstance m_instance;
 			vk::detail::DispatchLoaderDynamic m_dispatch;
 			vk::UniqueHandle<vk::DebugUtilsMessengerEXT, vk::detail::DispatchLoaderDynamic> m_debugMessenger;
 
 			vk::PhysicalDevice m_physicalDevice;
 			vk::UniqueDevice m_device;
+			// everything below that holds device memory has to be gone before it
+			std::unique_ptr<DeviceAllocator> m_allocator;
+			vk::DeviceSize m_stagingSize = 16*1024*1024;
+			std::unique_ptr<StagingRing> m_staging;
+			uint32_t m_graphicsQueueFamilyIndex;
+			uint32_t m_transferQueueFamilyIndex;
+			bool m_dedicatedTransfer = false;
+
+			// ns per timestamp tick, and the bits of a timestamp that are valid on the graphics queue (none without support)
+			float m_timestampPeriod = 1.0f;
+			uint64_t m_timestampMask = 0;
+			// difference of two timestamps in μs
+			double timestampDelta(uint64_t from, uint64_t to) const;
+
+			vk::UniquePipelineCache m_pipelineCache;
+			std::optional<std::filesystem::path> m_pipelineCachePath;
+			size_t m_pipelineCacheMaxBytes = 64*1024*1024;
+			std::chrono::seconds m_pipelineCacheSaveInterval{300};
+			// shared for pipeline creation, exclusive for saving or resetting the cache
+			mutable std::shared_mutex m_pipelineCacheMutex;
+			std::mutex m_pipelineCacheWriteMutex;
+			PipelineCacheStats m_pipelineCacheStats{};
+			// created since the last save, with m_pipelineCacheMutex held
+			uint64_t m_pipelinesUnsaved = 0;
+			// saves the cache every m_pipelineCacheSaveInterval if there is anything new in it, until the backend is destroyed
+			void pipelineCacheSaver();
+			std::thread m_pipelineCacheSaverThread;
+			std::mutex m_pipelineCacheSaverMutex;
+			std::condition_variable m_pipelineCacheSaverWake;
+			bool m_pipelineCacheSaverStop = false;
 			vk::Queue m_queue;
 			vk::Queue m_transferQueue;
-			vk::UniqueFence m_fence;
-			vk::UniqueFence m_transferFence;
+			std::mutex m_queueMutex;
+			std::mutex m_transferQueueMutex;
 
+			// only used for uploads that do not belong to a context, like the grid mesh
 			vk::UniqueCommandPool m_commandPool;
-			vk::UniqueCommandBuffer m_commandBuffer;
-			vk::UniqueCommandBuffer m_computeCommandBuffer;
-
-			vk::UniqueBuffer m_outputImageBuffer;
-			vk::MemoryRequirements m_outputImageMemoryRequirements;
-			vk::UniqueDeviceMemory m_outputImageMemory;
+			vk::UniqueCommandPool m_transferCommandPool;
+			vk::UniqueCommandBuffer m_uploadCommandBuffer;
+			vk::UniqueCommandBuffer m_uploadAcquireCommandBuffer;
+			vk::UniqueSemaphore m_uploadSemaphore;
+			std::optional<StagingRing::Region> m_lastUpload;
+			std::mutex m_uploadMutex;
 
 			std::unique_ptr<Mesh> m_gridMesh;
 
-			vk::UniqueBuffer m_uniformBuffer;
-			vk::UniqueDeviceMemory m_uniformMemory;
-
-			vk::UniqueBuffer m_outputStorageBuffer;
-			vk::UniqueDeviceMemory m_outputStorageMemory;
-
 			vk::UniqueSampler m_sampler;
 
-			ImageData* m_renderImage;
-			ImageData* m_depthImage;
 			vk::UniqueRenderPass m_renderPass;
-			vk::UniqueFramebuffer m_framebuffer;
 
 			vk::UniqueDescriptorSetLayout m_descriptorSetLayout;
 			vk::UniqueDescriptorSetLayout m_computeDescriptorSetLayout;
-			vk::UniqueDescriptorPool m_descriptorPool;
-			vk::UniqueDescriptorSet m_descriptorSet;
-			vk::UniqueDescriptorSet m_computeDescriptorSet;
 
 			vk::UniquePipelineLayout m_pipelineLayout;
-			vk::UniquePipeline m_pipeline;
-
 			vk::UniquePipelineLayout m_computePipelineLayout;
-			vk::UniquePipeline m_computePipeline;
 
-			std::unique_ptr<ImageData> m_encodedImageY;
-			std::unique_ptr<ImageData> m_encodedImageCr;
-			std::unique_ptr<ImageData> m_encodedImageCb;
 			vk::UniqueDescriptorSetLayout m_descriptorSetLayoutEncode;
-			vk::UniqueDescriptorSet m_descriptorSetEncode;
 			vk::UniquePipelineLayout m_pipelineLayoutEncode;
+			// YUV and palette conversion, they share the layout
 			vk::UniquePipeline m_encodePipeline;
-			vk::UniquePipeline createEncodePipeline();
+			vk::UniquePipeline m_palettePipeline;
+			vk::UniquePipeline createEncodePipeline(const std::string& shader);
+
+			// Render targets and buffers for every size that was rendered at, created on first use.
+			// Idle ones are kept up to m_framePoolBudget bytes, the least recently used go first.
+			RenderTarget* acquireTarget(vk::Extent2D extent);
+			void releaseTarget(RenderTarget* target);
+			PooledBuffer* acquireBuffer(vk::DeviceSize size, bool host);
+			std::unique_ptr<PooledBuffer> createPooledBuffer(vk::DeviceSize size, bool host);
+			// with m_framePoolMutex held
+			void trimFramePool();
+			size_t m_framePoolBudget = 64*1024*1024;
+			std::vector<std::unique_ptr<RenderTarget>> m_targets;
+			std::vector<std::unique_ptr<PooledBuffer>> m_pooledBuffers;
+			uint64_t m_framePoolCreated = 0;
+			uint64_t m_framePoolEvicted = 0;
+			mutable std::mutex m_framePoolMutex;
+
+			// declared last, so the contexts are destroyed before anything they were created from
+			std::vector<std::unique_ptr<RenderContext>> m_contexts;
+			std::vector<RenderContext*> m_idleContexts;
+			std::mutex m_contextMutex;
+			std::condition_variable m_contextAvailable;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,11 @@
+#version 450
+
+// Stands in for base.vert: one triangle that covers the whole screen, with the same coordinates the grid would give.
+layout(location = 0) out vec2 outCoord;
+
+void main()
+{
+	vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) * 2.0 - 1.0;
+	gl_Position = vec4(position, 0.0, 1.0);
+	outCoord = (position + vec2(1.0)) / 2.0;
+}
@@ -1,89 +1,18 @@
 #include "bot.hpp"
 
 #include <algorithm>
-#include <dpp/dpp.h>
 #include <av.h>
 #include <avutils.h>
 #include <filesystem>
+#include <thread>
 #include <glm/gtx/string_cast.hpp>
 
 #include "vulkan_backend.h"
+#include "video_encoder.h"
 
 using namespace vulkanbot;
 
 namespace vulkanbot {
-	std::vector<shader> find_shaders(const std::string& message, shader_type default_type = shader_type::frag) {
-		std::vector<shader> shaders{};
-
-		std::string::size_type pos = 0;
-		while(pos < message.size() && pos != std::string::npos) {
-			pos = message.find("``", pos);
-			if(pos == std::string::npos) {
-				break;
-			}
-
-			shader shader = {.type = shader_type::unknown};
-			if(pos >= 4) {
-				std::string t = message.substr(pos-4, 4);
-				if(t == "vert") {
-					shader.type = shader_type::vert;
-				} else if(t == "frag") {
-					shader.type = shader_type::frag;
-				} else if(t == "comp") {
-					shader.type = shader_type::comp;
-				}
-			}
-
-			std::string quotes = message.substr(pos, 3);
-			if(quotes == "```") {
-				pos = message.find("\n", pos);
-				auto begin = pos+1;
-
-				pos = message.find("```", pos);
-
-				std::string code = message.substr(begin, pos-begin);
-				pos += 3;
-
-				shader.data = code;
-				shader.file = false;
-				if(shader.type == shader_type::unknown) {
-					if(code.contains("gl_Position")) {
-						shader.type = shader_type::vert;
-					} else {
-						shader.type = default_type;
-					}
-				}
-			} else {
-				pos += 2;
-
-				auto begin = pos;
-				pos = message.find("``", pos);
-
-				std::string file = message.substr(begin, pos-begin);
-				pos += 2;
-
-				std::filesystem::path p(file);
-				shader.data = p;
-				shader.file = true;
-
-				if(shader.type == shader_type::unknown) {
-					auto t = p.extension().string();
-					if(t == "vert") {
-						shader.type = shader_type::vert;
-					} else if(t == "frag") {
-						shader.type = shader_type::frag;
-					} else if(t == "comp") {
-						shader.type = shader_type::comp;
-					} else {
-						shader.type = default_type;
-					}
-				}
-			}
-			shaders.push_back(shader);
-		}
-		return shaders;
-	}
-
 	std::optional<std::filesystem::path> find_first_existing(std::initializer_list<std::filesystem::path> paths) {
 		for(auto& p : paths) {
 			if(std::filesystem::exists(p)) {
@@ -93,11 +22,9 @@ namespace vulkanbot {
 		return std::nullopt;
 	}
 
-	VulkanBot::VulkanBot(const nlohmann::json& config) : bot(static_cast<std::string>(config["discord"]["token"])) {
+	VulkanBot::VulkanBot(const nlohmann::json& config, std::shared_ptr<HttpClient> http) : http(std::move(http)) {
 		m_maxFrames = config["video"]["max"]["frames"];
 
-		bot.on_log(dpp::utility::cout_logger());
-
 		std::filesystem::path executable_path = std::filesystem::read_symlink("/proc/self/exe");
 		std::filesystem::path shaders_path;
 		if(config.contains("paths") && config["paths"].contains("shaders")) {
@@ -128,148 +55,226 @@ namespace vulkanbot {
 		std::cout << "Shader include path: " << shader_include_path << std::endl;
 
 		initVulkan(config, shaders_path, shader_include_path);
-		bot.on_message_context_menu([this](const dpp::message_context_menu_t& event){
-			std::string command_name = event.command.get_command_name();
-			std::transform(command_name.begin(), command_name.end(), command_name.begin(),
-				[](unsigned char c){ return std::tolower(c); });
 
-			shader_type def = command_name == "compute" ? shader_type::comp : shader_type::frag;
-			auto shaders = find_shaders(event.get_message().content, def);
-			if(shaders.empty()) {
-				event.reply("Error: No shaders found in message");
+		// jobs only hold a context while rendering, so the others can download and compile in the meantime
+		unsigned int workers = backend.contextCount() * 2;
+		size_t max_queued = 32;
+		if(config.contains("jobs")) {
+			if(config["jobs"].contains("workers"))
+				workers = config["jobs"]["workers"];
+			if(config["jobs"].contains("queue"))
+				max_queued = config["jobs"]["queue"];
+		}
+		scheduler = std::make_unique<JobScheduler>(workers, max_queued);
+		// every job fetches at most one texture, so there is always room for the ones of the running and queued jobs
+		fetch_scheduler = std::make_unique<JobScheduler>(workers, max_queued + workers);
+
+		register_metrics();
+		if(config.contains("metrics")) {
+			std::string address = config["metrics"].contains("address") ? config["metrics"]["address"].get<std::string>() : "127.0.0.1";
+			uint16_t port = config["metrics"].contains("port") ? (uint16_t)config["metrics"]["port"] : 9464;
+			metrics_server = std::make_unique<MetricsServer>(metrics, address, port);
+		}
+	}
+	void VulkanBot::handle_command(std::shared_ptr<Interaction> interaction, std::string command, const std::string& content,
+		const std::string& texture) {
+		std::transform(command.begin(), command.end(), command.begin(),
+			[](unsigned char c){ return std::tolower(c); });
+
+		shader_type def = command == "compute" ? shader_type::comp : shader_type::frag;
+		auto shaders = find_shaders(content, def);
+		if(shaders.empty()) {
+			interaction->reply("Error: No shaders found in message");
+			return;
+		}
+
+		if(command == "compute") {
+			if(shaders.size() != 1 || shaders[0].type != shader_type::comp) {
+				interaction->reply("Error: Exactly one compute shader required");
 				return;
 			}
+			enqueue_job(interaction, JobPriority::High, [this, interaction, shaders, texture](){
+				do_compute(*interaction, shaders[0], texture);
+			});
+			return;
+		}
 
-			std::string texture = event.get_message().author.get_avatar_url();
-			for(const auto& a : event.get_message().attachments) {
-				if(a.content_type == "image/png") {
-					texture = a.url;
-					break;
-				}
+		if(shaders.size() > 2) {
+			interaction->reply("Error: No more than two shaders allowed");
+			return;
+		}
+		shader vert{.data = "base", .type = shader_type::vert, .file = true};
+		shader frag{.data = "base", .type = shader_type::frag, .file = true};
+		for(auto& s : shaders) {
+			if(s.type == shader_type::vert) { vert = s; }
+			else if(s.type == shader_type::frag) { frag = s; }
+			else {
+				interaction->reply("Error: Only vertex and fragment shaders allowed");
+				return;
 			}
-
-			if(command_name == "compute") {
-				if(shaders.size() != 1 || shaders[0].type != shader_type::comp) {
-					event.reply("Error: Exactly one compute shader required");
-					return;
+		}
+		// a "size" line asks for another size than the default one, up to the configured maximum
+		std::pair<int, int> size = find_size(content).value_or(std::pair{m_width, m_height});
+		int width = std::min(size.first, m_maxWidth);
+		int height = std::min(size.second, m_maxHeight);
+		if(command == "render image") {
+			enqueue_job(interaction, JobPriority::High, [this, interaction, vert, frag, texture, width, height](){
+				do_render(*interaction, vert, frag, texture, width, height);
+			});
+		} else if(command == "render video") {
+			// the video encoders only take even sizes
+			width = std::max(width / 2 * 2, 2);
+			height = std::max(height / 2 * 2, 2);
+			animation defaults{m_defaultFrames, m_defaultFPS, m_defaultStart, m_defaultEnd, m_bitrate};
+			interaction->ask_animation(defaults, [this, vert, frag, texture, width, height](std::shared_ptr<Interaction> answer, animation a){
+				a.frames = std::min(a.frames, m_maxFrames);
+				a.bitrate = m_bitrate;
+				if(a.format != "gif" && (a.format != "webp" || !m_webp)) {
+					a.format = "mp4";
 				}
-				std::thread t([this, event, shaders, texture](){
-					do_compute(event, event.get_message(), shaders[0], texture);
+				enqueue_job(answer, JobPriority::Low, [this, answer, vert, frag, texture, width, height, a](){
+					do_render(*answer, vert, frag, texture, width, height, a);
 				});
-				t.detach();
-			}
-			else {
-				if(shaders.size() > 2) {
-					event.reply("Error: No more than two shaders allowed");
-					return;
-				}
-				shader vert{.data = "base", .type = shader_type::vert, .file = true};
-				shader frag{.data = "base", .type = shader_type::frag, .file = true};
-				for(auto& s : shaders) {
-					if(s.type == shader_type::vert) { vert = s; }
-					else if(s.type == shader_type::frag) { frag = s; }
-					else {
-						event.reply("Error: Only vertex and fragment shaders allowed");
-						return;
-					}
-				}
-				if(command_name == "render image") {
-					std::thread t([this, event, vert, frag, texture](){
-						do_render(event, event.get_message(), vert, frag, texture);
-					});
-					t.detach();
-				} else if(command_name == "render video") {
-					unsigned long long int id = next_animation_id++;
-					pending_animations[id] = {
-						.vert = vert, .frag = frag, .texture = texture, .event = event
-					};
-					dpp::interaction_modal_response modal(std::to_string(id), "Animation Settings");
-					modal.add_component(dpp::component()
-						.set_label("Frames") .set_id("frames")
-						.set_type(dpp::cot_text)
-						.set_placeholder(std::to_string(m_defaultFrames))
-						.set_min_length(1) .set_max_length(5) .set_text_style(dpp::text_short));
-					modal.add_row();
-					modal.add_component(dpp::component()
-						.set_label("FPS").set_id("fps")
-						.set_type(dpp::cot_text)
-						.set_placeholder(std::to_string(m_defaultFPS))
-						.set_min_length(1).set_max_length(5).set_text_style(dpp::text_short));
-					modal.add_row();
-					modal.add_component(dpp::component()
-						.set_label("Start value of t").set_id("t_start")
-						.set_type(dpp::cot_text)
-						.set_placeholder(std::to_string(m_defaultStart))
-						.set_min_length(1).set_max_length(5).set_text_style(dpp::text_short));
-					modal.add_row();
-					modal.add_component(dpp::component()
-						.set_label("End value of t").set_id("t_end")
-						.set_type(dpp::cot_text)
-						.set_placeholder(std::to_string(m_defaultEnd))
-						.set_min_length(1).set_max_length(5).set_text_style(dpp::text_short));
-					event.dialog(modal);
-				} else {
-					event.reply("Error: Unknown command");
-				}
+			});
+		} else {
+			interaction->reply("Error: Unknown command");
+		}
+	}
+	void VulkanBot::enqueue_job(std::shared_ptr<Interaction> interaction, JobPriority priority, std::function<void()> job) {
+		// defer the response right away, the job itself might not start for a while
+		interaction->thinking();
+
+		// reported before submitting, a worker may pick the job up before submit returns
+		interaction->job_state(JobState::Queued);
+		auto submitted = std::chrono::steady_clock::now();
+		std::optional<size_t> position = scheduler->submit(priority, [this, interaction, submitted, job = std::move(job)](){
+			stage("queue_wait").observe(secondsSince(submitted));
+			interaction->job_state(JobState::Started);
+
+			auto started = std::chrono::steady_clock::now();
+			// whatever went wrong, the user gets an answer instead of waiting on "thinking..." forever
+			try {
+				job();
+			} catch(const std::exception& e) {
+				std::cerr << "Job failed: " << e.what() << std::endl;
+				fail(*interaction, std::string("Error: ") + e.what());
+				interaction->job_state(JobState::Finished);
+				return;
+			} catch(...) {
+				std::cerr << "Job failed with an unknown error" << std::endl;
+				fail(*interaction, "Error: internal error");
+				interaction->job_state(JobState::Finished);
+				return;
 			}
+			stage("job").observe(secondsSince(started));
+			interaction->job_state(JobState::Finished);
 		});
-		bot.on_form_submit([this](const dpp::form_submit_t & event) {
-			unsigned long long int id = std::stoull(event.custom_id);
-	        animation_render_data data = pending_animations.at(id);
-			pending_animations.erase(id);
-
-			auto parse = []<typename T>(const std::string s)->std::optional<T> {
-				T value{};
-				if(std::from_chars(s.data(), s.data()+s.size(), value).ec == std::errc{}) {
-					return value;
-				} else {
-					return std::nullopt;
-				}
-			};
-
-			int frames = parse.template operator()<int>(std::get<std::string>(event.components[0].components[0].value)).value_or(m_defaultFrames);
-			int fps = parse.template operator()<int>(std::get<std::string>(event.components[1].components[0].value)).value_or(m_defaultFPS);
-			float tStart = parse.template operator()<float>(std::get<std::string>(event.components[2].components[0].value)).value_or(m_defaultStart);
-			float tEnd = parse.template operator()<float>(std::get<std::string>(event.components[3].components[0].value)).value_or(m_defaultEnd);
-
-			frames = std::min(frames, m_maxFrames);
-			long bitrate = m_bitrate;
-
-			animation a{frames, fps, tStart, tEnd, bitrate};
-
-			std::thread t([this, event, data, a](){
-				do_render(event, data.event.get_message(), data.vert, data.frag, data.texture, a);
-			});
-			t.detach();
-	    });
-		bot.on_ready([this](const dpp::ready_t & event) {
-	        if (dpp::run_once<struct register_bot_commands>()) {
-				std::vector<dpp::interaction_context_type> contexts = {
-					dpp::itc_guild, dpp::itc_bot_dm, dpp::itc_private_channel
-				};
-
-				std::vector<dpp::slashcommand> commands = {
-					dpp::slashcommand("Render Image", "Render as an image", bot.me.id)
-						.set_type(dpp::ctxm_message).set_dm_permission(true).set_interaction_contexts(contexts),
-					dpp::slashcommand("Render Video", "Render as an animation", bot.me.id)
-						.set_type(dpp::ctxm_message).set_dm_permission(true).set_interaction_contexts(contexts),
-					dpp::slashcommand("Compute", "Execute as compute shader", bot.me.id)
-						.set_type(dpp::ctxm_message).set_dm_permission(true).set_interaction_contexts(contexts),
-				};
-				bot.global_bulk_command_create(commands);
-
-				bot.set_presence(dpp::presence(dpp::ps_online, dpp::at_game, "with shaders!"));
-				std::cout << "Registered commands!\n";
-				std::cout << "Bot Username: " << bot.me.username << '\n';
-	        }
-	    });
+		if(!position) {
+			interaction->job_state(JobState::Rejected);
+			interaction->edit_response("Error: Queue full, please try again later");
+		} else if(*position > 0) {
+			interaction->edit_response("Queued at position "+std::to_string(*position)+"...");
+		}
+	}
+	void VulkanBot::fail(Interaction& interaction, const std::string& error) {
+		metrics.counter("vulkan_bot_job_failures_total", "Jobs that ended with an error").add();
+		interaction.edit_response(error);
+	}
+	Histogram& VulkanBot::stage(const std::string& name) {
+		return metrics.histogram("vulkan_bot_stage_seconds", "Time spent in each stage of a job", "stage=\""+name+"\"");
 	}
-	void VulkanBot::run() {
-		bot.start(dpp::st_wait);
+	void VulkanBot::observe_gpu(const GpuTimings& timings) {
+		if(!timings.measured)
+			return;
+		stage("gpu_shader").observe(timings.shader / 1e6);
+		if(timings.encode > 0.0)
+			stage("gpu_encode").observe(timings.encode / 1e6);
+		if(timings.readback > 0.0)
+			stage("gpu_readback").observe(timings.readback / 1e6);
+	}
+	void VulkanBot::register_metrics() {
+		metrics.counter("vulkan_bot_job_failures_total", "Jobs that ended with an error");
+		metrics.counter("vulkan_bot_jobs_total", "Jobs by outcome in the scheduler", "result=\"completed\"",
+			[this](){ return scheduler->stats().completed; });
+		metrics.counter("vulkan_bot_jobs_total", "Jobs by outcome in the scheduler", "result=\"rejected\"",
+			[this](){ return scheduler->stats().rejected; });
+		metrics.gauge("vulkan_bot_jobs", "Jobs waiting for or running on a worker", "state=\"queued\"",
+			[this](){ return scheduler->stats().queued; });
+		metrics.gauge("vulkan_bot_jobs", "Jobs waiting for or running on a worker", "state=\"running\"",
+			[this](){ return scheduler->stats().running; });
+
+		const std::string texture_lookups = "Texture cache lookups by level and result";
+		metrics.counter("vulkan_bot_texture_cache_lookups_total", texture_lookups, "level=\"decoded\",result=\"hit\"",
+			[this](){ return texture_cache->stats().decodedHits; });
+		metrics.counter("vulkan_bot_texture_cache_lookups_total", texture_lookups, "level=\"decoded\",result=\"miss\"",
+			[this](){ return texture_cache->stats().decodedMisses; });
+		metrics.counter("vulkan_bot_texture_cache_lookups_total", texture_lookups, "level=\"resident\",result=\"hit\"",
+			[this](){ return texture_cache->stats().residentHits; });
+		metrics.counter("vulkan_bot_texture_cache_lookups_total", texture_lookups, "level=\"resident\",result=\"miss\"",
+			[this](){ return texture_cache->stats().residentMisses; });
+		metrics.gauge("vulkan_bot_texture_cache_bytes", "Bytes held by the texture cache", "level=\"decoded\"",
+			[this](){ return texture_cache->stats().decodedBytes; });
+		metrics.gauge("vulkan_bot_texture_cache_bytes", "Bytes held by the texture cache", "level=\"resident\"",
+			[this](){ return texture_cache->stats().residentBytes; });
+
+		const std::string shader_lookups = "Shader cache lookups by result";
+		metrics.counter("vulkan_bot_shader_cache_lookups_total", shader_lookups, "result=\"memory_hit\"",
+			[this](){ return backend.shaderCacheStats().memoryHits; });
+		metrics.counter("vulkan_bot_shader_cache_lookups_total", shader_lookups, "result=\"disk_hit\"",
+			[this](){ return backend.shaderCacheStats().diskHits; });
+		metrics.counter("vulkan_bot_shader_cache_lookups_total", shader_lookups, "result=\"miss\"",
+			[this](){ return backend.shaderCacheStats().misses; });
+		metrics.gauge("vulkan_bot_shader_cache_bytes", "Bytes of SPIR-V held in memory by the shader cache", "",
+			[this](){ return backend.shaderCacheStats().bytes; });
+		metrics.counter("vulkan_bot_pipelines_created_total", "Pipelines created through the pipeline cache", "",
+			[this](){ return backend.pipelineCacheStats().pipelinesCreated; });
+
+		const std::string frame_pool = "Bytes of render targets and readback buffers in the frame pool";
+		metrics.gauge("vulkan_bot_frame_pool_bytes", frame_pool, "state=\"busy\"",
+			[this](){ return backend.framePoolStats().busyBytes; });
+		metrics.gauge("vulkan_bot_frame_pool_bytes", frame_pool, "state=\"idle\"",
+			[this](){ return backend.framePoolStats().idleBytes; });
+		metrics.counter("vulkan_bot_frame_pool_evictions_total", "Idle render targets and readback buffers freed to stay within the budget", "",
+			[this](){ return backend.framePoolStats().evicted; });
+
+		const std::string device_memory = "Bytes of device memory allocated in blocks and the part of it sub-allocated to resources";
+		metrics.gauge("vulkan_bot_device_memory_bytes", device_memory, "state=\"reserved\"",
+			[this](){ return backend.allocatorStats().reservedBytes; });
+		metrics.gauge("vulkan_bot_device_memory_bytes", device_memory, "state=\"used\"",
+			[this](){ return backend.allocatorStats().usedBytes; });
+		metrics.gauge("vulkan_bot_device_memory_blocks", "Blocks of device memory that are allocated", "",
+			[this](){ return backend.allocatorStats().blocks; });
+		metrics.gauge("vulkan_bot_device_memory_allocations", "Resources sub-allocated from the blocks", "",
+			[this](){ return backend.allocatorStats().allocations; });
+		metrics.counter("vulkan_bot_staging_waits_total", "Uploads that waited for the staging ring to free up", "",
+			[this](){ return backend.stagingStats().waits; });
+
+		metrics.gauge("vulkan_bot_resident_memory_bytes", "Resident set size of the process", "",
+			[](){ return residentMemory(); });
+	}
+	float VulkanBot::next_random() {
+		std::unique_lock lock(random_lock);
+		return dist(e2);
 	}
 	void VulkanBot::initVulkan(const nlohmann::json& config, const std::filesystem::path& shaders_path, const std::filesystem::path& shader_include_path) {
 		m_width = config["image"]["width"];
 		m_height = config["image"]["height"];
+		m_maxWidth = m_width;
+		m_maxHeight = m_height;
+		if(config["image"].contains("max"))
+		{
+			m_maxWidth = config["image"]["max"].contains("width") ? (int)config["image"]["max"]["width"] : m_width;
+			m_maxHeight = config["image"]["max"].contains("height") ? (int)config["image"]["max"]["height"] : m_height;
+		}
+		m_pngCompression = PngCompression::Default;
+		if(config["image"].contains("compression"))
+		{
+			std::string compression = config["image"]["compression"];
+			if(auto parsed = parsePngCompression(compression))
+				m_pngCompression = *parsed;
+			else
+				std::cerr << "Unknown image compression \"" << compression << "\", using default" << std::endl;
+		}
 
 		m_maxFrames = config["video"]["max"]["frames"];
 		m_maxBitrate = config["video"]["max"]["bitrate"];
@@ -283,6 +288,36 @@ namespace vulkanbot {
 		m_renderProgress = config["video"]["renderprogress"]["enable"];
 		m_renderProgressDelay = config["video"]["renderprogress"]["delay"];
 
+		// number of video frames the GPU may render ahead of the encoder
+		int framesInFlight = config["video"].contains("inflight") ? (int)config["video"]["inflight"] : 3;
+		// number of video frames recorded into a single submission
+		int batchSize = config["video"].contains("batch") ? (int)config["video"]["batch"] : 4;
+		// number of jobs that can render at the same time, each one has its own set of GPU resources
+		int renderContexts = 2;
+		if(config.contains("render") && config["render"].contains("contexts"))
+			renderContexts = config["render"]["contexts"];
+		if(config.contains("render") && config["render"].contains("preview"))
+		{
+			nlohmann::json preview = config["render"]["preview"];
+			m_preview = preview.contains("enable") ? (bool)preview["enable"] : true;
+			m_previewDivisor = std::max(preview.contains("divisor") ? (int)preview["divisor"] : 2, 1);
+			m_previewBudget = (preview.contains("budget") ? (int)preview["budget"] : 1500) / 1000.0;
+		}
+		// bytes of render targets and readback buffers of past jobs kept around for the next ones of the same size
+		if(config.contains("render") && config["render"].contains("pool"))
+			backend.configureFramePool(config["render"]["pool"]);
+		// bytes of the ring textures and meshes are uploaded through
+		if(config.contains("render") && config["render"].contains("staging"))
+			backend.configureStaging(config["render"]["staging"]);
+		// encoder threads per video, by default the cores are shared between the contexts that encode at the same time
+		m_videoThreads = std::max(std::thread::hardware_concurrency() / std::max(renderContexts, 1), 1u);
+		if(config["video"].contains("threads") && (int)config["video"]["threads"] > 0)
+			m_videoThreads = config["video"]["threads"];
+		// the same for PNG encoding, which otherwise starts a thread per core for every image
+		m_imageThreads = std::max(std::thread::hardware_concurrency() / std::max(renderContexts, 1), 1u);
+		if(config["image"].contains("threads") && (int)config["image"]["threads"] > 0)
+			m_imageThreads = config["image"]["threads"];
+
 		e2 = std::mt19937(rd());
 		dist = std::uniform_real_distribution<>(0.0, 1.0);
 
@@ -317,65 +352,54 @@ namespace vulkanbot {
 		}
 		av::init();
 		av::setFFmpegLoggingLevel(avLogLevel);
+		m_webp = VideoEncoder::supports("webp");
+		if(!m_webp)
+			std::cerr << "FFmpeg was built without libwebp, WebP videos are rendered as MP4" << std::endl;
 
-		backend.initVulkan(m_width, m_height, shaders_path, shader_include_path,
-			vulkanValidate, vulkanDebugSeverity, vulkanDebugType);
-	}
-}
-
-void INThandler(int sig)
-{
-	exit(0);
-}
-
-int main(int argc, char** argv)
-{
-	std::signal(SIGINT, INThandler);
-
-	std::filesystem::path config_path;
-	if(argc > 1) {
-		config_path = argv[1];
-	} else if(const char* env = std::getenv("VULKAN_BOT_CONFIG")) {
-		config_path = env;
-	} else {
-		config_path = find_first_existing({
-			"/etc/vulkan_bot/config.json",
-			std::filesystem::current_path() / "config.json",
-		}).value_or("config.json");
-	}
-
-	nlohmann::json j;
-	{
-		std::ifstream config(config_path);
-		if(!config) {
-			std::cerr << "Could not open config file at " << config_path << std::endl;
-			return 1;
+		if(config.contains("cache") && config["cache"].contains("shaders"))
+		{
+			nlohmann::json shaderCache = config["cache"]["shaders"];
+			std::optional<std::filesystem::path> directory;
+			if(shaderCache.contains("path"))
+				directory = shaderCache["path"].get<std::string>();
+			size_t memory = shaderCache.contains("memory") ? (size_t)shaderCache["memory"] : 16*1024*1024;
+			size_t disk = shaderCache.contains("disk") ? (size_t)shaderCache["disk"] : 256*1024*1024;
+			backend.initShaderCache(directory, memory, disk);
 		}
-		config >> j;
-	}
-
-	std::filesystem::path shaders_directory;
-	if(auto* path = std::getenv("VULKAN_BOT_SHADER_DIRECTORY")) {
-		shaders_directory = path;
-	}
-	else {
-		std::filesystem::path exe_directory = std::filesystem::canonical("/proc/self/exe").parent_path();
-		do {
-			if(std::filesystem::exists(shaders_directory = exe_directory / "shaders"))
-				break;
-			if(std::filesystem::exists(shaders_directory = exe_directory / ".." / "share" / "vulkan_bot" / "shaders"))
-				break;
-			if(std::filesystem::exists(shaders_directory = std::filesystem::current_path() / "shaders"))
-				break;
+		if(config["video"].contains("format"))
+		{
+			std::string format = config["video"]["format"];
+			if(format != "yuv420p" && format != "nv12")
+				std::cerr << "Unknown video format \"" << format << "\", using yuv420p" << std::endl;
+			m_nv12 = format == "nv12";
+		}
+		if(config.contains("compiler") && config["compiler"].contains("threads"))
+		{
+			backend.configureShaderCompiler(config["compiler"]["threads"]);
+		}
+		if(config.contains("cache") && config["cache"].contains("pipelines"))
+		{
+			nlohmann::json pipelineCache = config["cache"]["pipelines"];
+			std::optional<std::filesystem::path> path;
+			if(pipelineCache.contains("path"))
+				path = pipelineCache["path"].get<std::string>();
+			size_t max = pipelineCache.contains("max") ? (size_t)pipelineCache["max"] : 64*1024*1024;
+			int interval = pipelineCache.contains("interval") ? (int)pipelineCache["interval"] : 300;
+			backend.configurePipelineCache(path, max, std::chrono::seconds(interval));
+		}
+		size_t decodedTextures = 64*1024*1024;
+		size_t residentTextures = 256*1024*1024;
+		if(config.contains("cache") && config["cache"].contains("textures"))
+		{
+			nlohmann::json textureCache = config["cache"]["textures"];
+			if(textureCache.contains("decoded"))
+				decodedTextures = textureCache["decoded"];
+			if(textureCache.contains("resident"))
+				residentTextures = textureCache["resident"];
+		}
+		texture_cache = std::make_unique<TextureCache>(decodedTextures, residentTextures);
 
-			std::cerr << "Could not find shaders directory.\nYou can specify it using the enviornment variable VULKAN_BOT_SHADER_DIRECTORY." << std::endl;
-			return 2;
-		} while(false);
+		backend.initVulkan(m_width, m_height, renderContexts, framesInFlight, batchSize, shaders_path, shader_include_path,
+			vulkanValidate, vulkanDebugSeverity, vulkanDebugType);
 	}
-
-	VulkanBot bot(j);
-	std::cout << "Running bot...\n";
-	bot.run();
-
-	return 0;
 }
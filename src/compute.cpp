@@ -1,51 +1,53 @@
 #include "bot.hpp"
 
-#include <lodepng.h>
 #include <glm/gtx/string_cast.hpp>
 
 namespace vulkanbot {
 
-void VulkanBot::do_compute(const dpp::interaction_create_t& event, const dpp::message& message, const shader& shader, const std::string& texture) {
-    event.thinking();
+void VulkanBot::do_compute(Interaction& interaction, const shader& shader, const std::string& texture) {
+    // the download runs while the shader compiles, only the upload and computation need a context
+    auto decoded = fetch_texture(texture);
 
-    std::cout << "Acquiring render lock..." << std::endl;
-    std::unique_lock lock(render_lock);
-    std::cout << "Start computing..." << std::endl;
+    PipelineResult pipeline = backend.createComputeShaderPipeline(shader.data, shader.file);
+    if(!pipeline.success) {
+        fail(interaction, "Error failed to upload shader: "+pipeline.error);
+        return;
+    }
+    stage("compile").observeMicroseconds(pipeline.compileTime);
+    stage("pipeline").observeMicroseconds(pipeline.pipelineTime);
 
-    auto [result, error] = backend.uploadComputeShader(shader.data, shader.file);
-    if(!result) {
-        event.edit_response("Error failed to upload shader: "+error);
+    std::shared_ptr<const DecodedTexture> decodedTexture = decoded.get();
+    if(!decodedTexture) {
+        fail(interaction, "Error: failed to decode texture");
         return;
     }
 
-    std::promise<std::string> p;
-    std::future<std::string> f = p.get_future();
-    bot.request(texture, dpp::http_method::m_get, [&p](const dpp::http_request_completion_t& c)mutable{
-        p.set_value(c.body);
-    });
+    // declared before the context, so on the way out the context is released (and done with the texture) first
+    std::shared_ptr<ImageData> vkImage;
+    std::cout << "Acquiring render context..." << std::endl;
+    auto t1 = std::chrono::steady_clock::now();
+    std::shared_ptr<RenderContext> context = backend.acquireContext();
+    stage("context_wait").observe(secondsSince(t1));
+    std::cout << "Start computing on context " << context->index() << "..." << std::endl;
 
-    std::vector<unsigned char> image;
-    unsigned int w, h;
-    auto body = f.get();
-    lodepng::decode(image, w, h, reinterpret_cast<unsigned char*>(body.data()), body.size());
-    std::unique_ptr<ImageData> vkImage = backend.uploadImage(w, h, image);
+    context->useComputePipeline(std::move(pipeline.pipeline));
+    vkImage = bind_texture(*context, decodedTexture);
 
-    backend.buildComputeCommandBuffer(1, 1, 1);
+    context->buildComputeCommandBuffer(1, 1, 1);
 
-    backend.updateUniformObject([this](UniformBufferObject* ubo){
-            ubo->time = 0.0f;
-            ubo->random = dist(e2);
-    });
-    backend.doComputation([this, event](OutputStorageObject* data, vk::Result result, long time)
+    context->setUniformObject({.time = 0.0f, .random = next_random()});
+    context->doComputation([this, &interaction](OutputStorageObject* data, vk::Result result, long time, const GpuTimings& timings)
     {
+        stage("gpu").observeMicroseconds(time);
+        observe_gpu(timings);
+
         std::string value =
             "float: " + std::to_string(data->as_float) + "\n" +
             "int  : " + std::to_string(data->as_int) + "\n" +
             "vec4 : " + glm::to_string(data->as_vec4) + "\n" +
             "ivec4: " + glm::to_string(data->as_ivec4) + "\n" +
             "chars: " + data->charsToString();
-        dpp::message msg({}, "Computation finished in "+std::to_string(time)+" μs!```"+value+"```");
-        event.edit_response(msg);
+        interaction.edit_response("Computation finished in "+std::to_string(time)+" μs!```"+value+"```");
     });
     std::cout << "Computation finished!" << std::endl;
 }
@@ -0,0 +1,269 @@
+#include "device_allocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace vulkanbot
+{
+	static vk::DeviceSize alignUp(vk::DeviceSize n, vk::DeviceSize alignment)
+	{
+		return (n + alignment - 1) / alignment * alignment;
+	}
+
+	Allocation::Allocation(Allocation&& other) noexcept
+		: m_allocator(other.m_allocator), m_block(other.m_block), m_offset(other.m_offset), m_size(other.m_size)
+	{
+		other.m_allocator = nullptr;
+		other.m_block = nullptr;
+	}
+
+	Allocation& Allocation::operator=(Allocation&& other) noexcept
+	{
+		if(this != &other)
+		{
+			if(m_allocator)
+				m_allocator->free(*this);
+			m_allocator = other.m_allocator;
+			m_block = other.m_block;
+			m_offset = other.m_offset;
+			m_size = other.m_size;
+			other.m_allocator = nullptr;
+			other.m_block = nullptr;
+		}
+		return *this;
+	}
+
+	Allocation::~Allocation()
+	{
+		if(m_allocator)
+			m_allocator->free(*this);
+	}
+
+	void Allocation::invalidate() const
+	{
+		if(!m_block->coherent)
+			m_allocator->m_device.invalidateMappedMemoryRanges(m_allocator->range(*this));
+	}
+
+	void Allocation::flush() const
+	{
+		if(!m_block->coherent)
+			m_allocator->m_device.flushMappedMemoryRanges(m_allocator->range(*this));
+	}
+
+	DeviceAllocator::DeviceAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize)
+		: m_device(device), m_memoryProperties(physicalDevice.getMemoryProperties()),
+		m_nonCoherentAtomSize(physicalDevice.getProperties().limits.nonCoherentAtomSize), m_blockSize(blockSize)
+	{
+	}
+
+	Allocation DeviceAllocator::allocate(vk::Buffer buffer, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred,
+		AllocationStrategy strategy)
+	{
+		Allocation allocation = allocate(m_device.getBufferMemoryRequirements(buffer), false, required, preferred, strategy);
+		m_device.bindBufferMemory(buffer, allocation.memory(), allocation.offset());
+		return allocation;
+	}
+
+	Allocation DeviceAllocator::allocate(vk::Image image, vk::MemoryPropertyFlags required, AllocationStrategy strategy)
+	{
+		Allocation allocation = allocate(m_device.getImageMemoryRequirements(image), true, required, {}, strategy);
+		m_device.bindImageMemory(image, allocation.memory(), allocation.offset());
+		return allocation;
+	}
+
+	Allocation DeviceAllocator::allocate(const vk::MemoryRequirements& requirements, bool image, vk::MemoryPropertyFlags required,
+		vk::MemoryPropertyFlags preferred, AllocationStrategy strategy)
+	{
+		auto findType = [&](vk::MemoryPropertyFlags flags) -> std::optional<uint32_t> {
+			for(uint32_t i=0; i<m_memoryProperties.memoryTypeCount; i++)
+			{
+				if((requirements.memoryTypeBits & (1u << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+					return i;
+			}
+			return std::nullopt;
+		};
+		std::optional<uint32_t> memoryType = findType(required | preferred);
+		if(!memoryType)
+			memoryType = findType(required);
+		if(!memoryType)
+			throw std::runtime_error("no memory type with " + vk::to_string(required));
+
+		vk::MemoryPropertyFlags properties = m_memoryProperties.memoryTypes[*memoryType].propertyFlags;
+		vk::DeviceSize size = requirements.size;
+		vk::DeviceSize alignment = requirements.alignment;
+		if((properties & vk::MemoryPropertyFlagBits::eHostVisible) && !(properties & vk::MemoryPropertyFlagBits::eHostCoherent))
+		{
+			alignment = std::max(alignment, m_nonCoherentAtomSize);
+			size = alignUp(size, m_nonCoherentAtomSize);
+		}
+
+		std::unique_lock lock(m_mutex);
+		auto key = std::make_tuple(*memoryType, image, strategy);
+		std::vector<std::unique_ptr<MemoryBlock>>& blocks = m_pools[key];
+
+		MemoryBlock* block = nullptr;
+		vk::DeviceSize offset = 0;
+		if(size > m_blockSize / 2)
+		{
+			blocks.push_back(createBlock(*memoryType, size));
+			block = blocks.back().get();
+			block->pool = key;
+			block->dedicated = true;
+		}
+		else
+		{
+			for(auto& b : blocks)
+			{
+				if(b->dedicated)
+					continue;
+				if(std::optional<vk::DeviceSize> placed = place(*b, size, alignment, strategy))
+				{
+					block = b.get();
+					offset = *placed;
+					break;
+				}
+			}
+			if(!block)
+			{
+				blocks.push_back(createBlock(*memoryType, m_blockSize));
+				block = blocks.back().get();
+				block->pool = key;
+				if(strategy == AllocationStrategy::FreeList)
+					block->free[0] = m_blockSize;
+				offset = *place(*block, size, alignment, strategy);
+			}
+		}
+		block->allocations++;
+		block->used += size;
+		m_allocations++;
+
+		Allocation allocation;
+		allocation.m_allocator = this;
+		allocation.m_block = block;
+		allocation.m_offset = offset;
+		allocation.m_size = size;
+		return allocation;
+	}
+
+	std::optional<vk::DeviceSize> DeviceAllocator::place(MemoryBlock& block, vk::DeviceSize size, vk::DeviceSize alignment,
+		AllocationStrategy strategy)
+	{
+		if(strategy == AllocationStrategy::Linear)
+		{
+			vk::DeviceSize offset = alignUp(block.head, alignment);
+			if(offset + size > block.size)
+				return std::nullopt;
+			block.head = offset + size;
+			return offset;
+		}
+
+		// first fit, the padding in front of an aligned offset stays a gap of its own
+		for(auto it = block.free.begin(); it != block.free.end(); it++)
+		{
+			auto [begin, length] = *it;
+			vk::DeviceSize offset = alignUp(begin, alignment);
+			if(offset + size > begin + length)
+				continue;
+
+			block.free.erase(it);
+			if(offset > begin)
+				block.free[begin] = offset - begin;
+			if(offset + size < begin + length)
+				block.free[offset + size] = begin + length - offset - size;
+			return offset;
+		}
+		return std::nullopt;
+	}
+
+	std::unique_ptr<MemoryBlock> DeviceAllocator::createBlock(uint32_t memoryType, vk::DeviceSize size)
+	{
+		std::unique_ptr<MemoryBlock> block = std::make_unique<MemoryBlock>();
+		block->memory = m_device.allocateMemoryUnique(vk::MemoryAllocateInfo(size, memoryType));
+		block->size = size;
+
+		vk::MemoryPropertyFlags properties = m_memoryProperties.memoryTypes[memoryType].propertyFlags;
+		block->coherent = static_cast<bool>(properties & vk::MemoryPropertyFlagBits::eHostCoherent);
+		if(properties & vk::MemoryPropertyFlagBits::eHostVisible)
+			block->data = static_cast<uint8_t*>(m_device.mapMemory(block->memory.get(), 0, VK_WHOLE_SIZE));
+
+		m_blocksAllocated++;
+		return block;
+	}
+
+	void DeviceAllocator::free(Allocation& allocation)
+	{
+		std::unique_lock lock(m_mutex);
+		MemoryBlock* block = allocation.m_block;
+		block->allocations--;
+		block->used -= allocation.m_size;
+		m_allocations--;
+
+		AllocationStrategy strategy = std::get<2>(block->pool);
+		if(block->allocations == 0)
+		{
+			// Nothing left in it. The first empty block of a pool is kept for the next allocation, so a pool that
+			// empties and fills up again does not cost a vkAllocateMemory every time, the memory of any other goes back to the driver.
+			std::vector<std::unique_ptr<MemoryBlock>>& blocks = m_pools[block->pool];
+			bool spare = !block->dedicated && std::none_of(blocks.begin(), blocks.end(), [block](const std::unique_ptr<MemoryBlock>& b){
+				return b.get() != block && !b->dedicated && b->allocations == 0;
+			});
+			if(spare)
+			{
+				block->head = 0;
+				block->free.clear();
+				if(strategy == AllocationStrategy::FreeList)
+					block->free[0] = block->size;
+				return;
+			}
+			std::erase_if(blocks, [block](const std::unique_ptr<MemoryBlock>& b){ return b.get() == block; });
+			return;
+		}
+
+		if(strategy == AllocationStrategy::FreeList)
+		{
+			// merge with the gaps right before and after it
+			vk::DeviceSize begin = allocation.m_offset;
+			vk::DeviceSize end = begin + allocation.m_size;
+			auto next = block->free.lower_bound(begin);
+			if(next != block->free.end() && next->first == end)
+			{
+				end += next->second;
+				next = block->free.erase(next);
+			}
+			if(next != block->free.begin())
+			{
+				auto previous = std::prev(next);
+				if(previous->first + previous->second == begin)
+				{
+					begin = previous->first;
+					block->free.erase(previous);
+				}
+			}
+			block->free[begin] = end - begin;
+		}
+	}
+
+	vk::MappedMemoryRange DeviceAllocator::range(const Allocation& allocation) const
+	{
+		// the size of a dedicated block is not necessarily a multiple of the atom size, the rest of the block is allowed instead
+		vk::DeviceSize size = allocation.m_offset + allocation.m_size >= allocation.m_block->size ? VK_WHOLE_SIZE : allocation.m_size;
+		return vk::MappedMemoryRange(allocation.m_block->memory.get(), allocation.m_offset, size);
+	}
+
+	DeviceAllocator::Stats DeviceAllocator::stats() const
+	{
+		std::unique_lock lock(m_mutex);
+		Stats stats{m_allocations, 0, m_blocksAllocated, 0, 0};
+		for(const auto& [key, blocks] : m_pools)
+		{
+			for(const auto& block : blocks)
+			{
+				stats.blocks++;
+				stats.reservedBytes += block->size;
+				stats.usedBytes += block->used;
+			}
+		}
+		return stats;
+	}
+}
@@ -0,0 +1,236 @@
+#include "discord_frontend.h"
+
+#include <algorithm>
+#include <charconv>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <dpp/dpp.h>
+
+#include "video_encoder.h"
+
+namespace vulkanbot {
+	class DiscordInteraction : public Interaction {
+	public:
+		DiscordInteraction(DiscordFrontend& frontend, const dpp::interaction_create_t& event, RecordedInteraction request)
+			: frontend(frontend), event(event), request(std::move(request)) {}
+
+		void reply(const std::string& content) override {
+			event.reply(content);
+		}
+		void thinking() override {
+			event.thinking();
+		}
+		void edit_response(const std::string& content, std::vector<Attachment> attachments) override {
+			dpp::message msg({}, content);
+			for(Attachment& a : attachments) {
+				dpp::message_file_data file;
+				file.name = std::move(a.name);
+				file.content = std::move(a.content);
+				file.mimetype = std::move(a.mimetype);
+				msg.file_data.push_back(std::move(file));
+			}
+			if(msg.file_data.empty() || !frontend.upload) {
+				event.edit_response(msg);
+				return;
+			}
+
+			Histogram* upload = frontend.upload;
+			auto t1 = std::chrono::steady_clock::now();
+			event.edit_response(msg, [upload, t1](const dpp::confirmation_callback_t& c){
+				if(c.is_error())
+					dpp::utility::log_error()(c);
+				else
+					upload->observe(secondsSince(t1));
+			});
+		}
+		void ask_animation(const animation& defaults, std::function<void(std::shared_ptr<Interaction>, animation)> answer) override {
+			frontend.ask_animation(event, request, defaults, std::move(answer));
+		}
+		void job_state(JobState state) override {
+			// commands that were turned down before reaching the scheduler are not worth replaying
+			if(state == JobState::Queued)
+				frontend.record(request);
+		}
+	private:
+		DiscordFrontend& frontend;
+		dpp::interaction_create_t event;
+		RecordedInteraction request;
+	};
+
+	class DiscordHttpClient : public HttpClient {
+	public:
+		DiscordHttpClient(dpp::cluster& cluster) : cluster(cluster) {}
+
+		std::string get(const std::string& url) override {
+			std::promise<std::string> p;
+			std::future<std::string> f = p.get_future();
+			cluster.request(url, dpp::http_method::m_get, [&p](const dpp::http_request_completion_t& c)mutable{
+				p.set_value(c.body);
+			});
+			return f.get();
+		}
+	private:
+		dpp::cluster& cluster;
+	};
+
+	DiscordFrontend::DiscordFrontend(const nlohmann::json& config) : cluster(static_cast<std::string>(config["discord"]["token"])) {
+		cluster.on_log(dpp::utility::cout_logger());
+
+		if(config.contains("debug") && config["debug"].contains("record")) {
+			std::string path = config["debug"]["record"];
+			recording.open(path, std::ios::app);
+			if(!recording) {
+				throw std::runtime_error("Cannot open recording "+path);
+			}
+			record_start = std::chrono::steady_clock::now();
+			std::cout << "Recording interactions to " << path << std::endl;
+		}
+	}
+	std::shared_ptr<HttpClient> DiscordFrontend::http_client() {
+		return std::make_shared<DiscordHttpClient>(cluster);
+	}
+	void DiscordFrontend::run(VulkanBot& bot, const std::atomic_bool& stop) {
+		upload = &bot.get_metrics().histogram("vulkan_bot_stage_seconds", "Time spent in each stage of a job", "stage=\"upload\"");
+
+		cluster.on_message_context_menu([this, &bot](const dpp::message_context_menu_t& event){
+			std::shared_lock handlers(handler_lock);
+			if(stopped)
+				return;
+
+			std::string command_name = event.command.get_command_name();
+			std::transform(command_name.begin(), command_name.end(), command_name.begin(),
+				[](unsigned char c){ return std::tolower(c); });
+
+			std::string texture = event.get_message().author.get_avatar_url();
+			for(const auto& a : event.get_message().attachments) {
+				if(a.content_type == "image/png") {
+					texture = a.url;
+					break;
+				}
+			}
+
+			RecordedInteraction request{.command = command_name, .content = event.get_message().content, .texture = texture};
+			bot.handle_command(std::make_shared<DiscordInteraction>(*this, event, request), command_name,
+				event.get_message().content, texture);
+		});
+		cluster.on_form_submit([this](const dpp::form_submit_t & event) {
+			std::shared_lock handlers(handler_lock);
+			if(stopped)
+				return;
+
+			unsigned long long int id = std::stoull(event.custom_id);
+			pending_animation pending;
+			{
+				std::unique_lock lock(pending_lock);
+				auto it = pending_animations.find(id);
+				if(it == pending_animations.end()) {
+					event.reply("Error: This dialog has expired");
+					return;
+				}
+				pending = std::move(it->second);
+				pending_animations.erase(it);
+			}
+
+			auto parse = []<typename T>(const std::string s)->std::optional<T> {
+				T value{};
+				if(std::from_chars(s.data(), s.data()+s.size(), value).ec == std::errc{}) {
+					return value;
+				} else {
+					return std::nullopt;
+				}
+			};
+
+			animation a = pending.defaults;
+			a.frames = parse.template operator()<int>(std::get<std::string>(event.components[0].components[0].value)).value_or(a.frames);
+			a.fps = parse.template operator()<int>(std::get<std::string>(event.components[1].components[0].value)).value_or(a.fps);
+			a.tStart = parse.template operator()<float>(std::get<std::string>(event.components[2].components[0].value)).value_or(a.tStart);
+			a.tEnd = parse.template operator()<float>(std::get<std::string>(event.components[3].components[0].value)).value_or(a.tEnd);
+			std::string format = std::get<std::string>(event.components[4].components[0].value);
+			std::transform(format.begin(), format.end(), format.begin(), [](unsigned char c){ return std::tolower(c); });
+			if(!format.empty()) {
+				a.format = format;
+			}
+
+			pending.request.video = a;
+			pending.answer(std::make_shared<DiscordInteraction>(*this, event, pending.request), a);
+		});
+		cluster.on_ready([this](const dpp::ready_t & event) {
+			if (dpp::run_once<struct register_bot_commands>()) {
+				std::vector<dpp::interaction_context_type> contexts = {
+					dpp::itc_guild, dpp::itc_bot_dm, dpp::itc_private_channel
+				};
+
+				std::vector<dpp::slashcommand> commands = {
+					dpp::slashcommand("Render Image", "Render as an image", cluster.me.id)
+						.set_type(dpp::ctxm_message).set_dm_permission(true).set_interaction_contexts(contexts),
+					dpp::slashcommand("Render Video", "Render as an animation", cluster.me.id)
+						.set_type(dpp::ctxm_message).set_dm_permission(true).set_interaction_contexts(contexts),
+					dpp::slashcommand("Compute", "Execute as compute shader", cluster.me.id)
+						.set_type(dpp::ctxm_message).set_dm_permission(true).set_interaction_contexts(contexts),
+				};
+				cluster.global_bulk_command_create(commands);
+
+				cluster.set_presence(dpp::presence(dpp::ps_online, dpp::at_game, "with shaders!"));
+				std::cout << "Registered commands!\n";
+				std::cout << "Bot Username: " << cluster.me.username << '\n';
+			}
+		});
+		cluster.start(dpp::st_return);
+		while(!stop) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		}
+		std::unique_lock lock(handler_lock);
+		stopped = true;
+	}
+	void DiscordFrontend::ask_animation(const dpp::interaction_create_t& event, RecordedInteraction request, const animation& defaults,
+		std::function<void(std::shared_ptr<Interaction>, animation)> answer) {
+		unsigned long long int id;
+		{
+			std::unique_lock lock(pending_lock);
+			id = next_animation_id++;
+			pending_animations[id] = {std::move(request), defaults, std::move(answer)};
+		}
+
+		dpp::interaction_modal_response modal(std::to_string(id), "Animation Settings");
+		modal.add_component(dpp::component()
+			.set_label("Frames") .set_id("frames")
+			.set_type(dpp::cot_text)
+			.set_placeholder(std::to_string(defaults.frames))
+			.set_min_length(1) .set_max_length(5) .set_text_style(dpp::text_short));
+		modal.add_row();
+		modal.add_component(dpp::component()
+			.set_label("FPS").set_id("fps")
+			.set_type(dpp::cot_text)
+			.set_placeholder(std::to_string(defaults.fps))
+			.set_min_length(1).set_max_length(5).set_text_style(dpp::text_short));
+		modal.add_row();
+		modal.add_component(dpp::component()
+			.set_label("Start value of t").set_id("t_start")
+			.set_type(dpp::cot_text)
+			.set_placeholder(std::to_string(defaults.tStart))
+			.set_min_length(1).set_max_length(5).set_text_style(dpp::text_short));
+		modal.add_row();
+		modal.add_component(dpp::component()
+			.set_label("End value of t").set_id("t_end")
+			.set_type(dpp::cot_text)
+			.set_placeholder(std::to_string(defaults.tEnd))
+			.set_min_length(1).set_max_length(5).set_text_style(dpp::text_short));
+		modal.add_row();
+		// only offers what the bot can encode, anything else ends up as mp4
+		static const bool webp = VideoEncoder::supports("webp");
+		modal.add_component(dpp::component()
+			.set_label(webp ? "Format (mp4, gif or webp)" : "Format (mp4 or gif)").set_id("format")
+			.set_type(dpp::cot_text)
+			.set_placeholder(defaults.format)
+			.set_min_length(1).set_max_length(4).set_text_style(dpp::text_short));
+		event.dialog(modal);
+	}
+	void DiscordFrontend::record(RecordedInteraction interaction) {
+		std::unique_lock lock(record_lock);
+		if(!recording.is_open())
+			return;
+		interaction.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - record_start).count();
+		recording << nlohmann::json(interaction).dump() << std::endl;
+	}
+}
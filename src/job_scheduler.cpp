@@ -0,0 +1,95 @@
+#include "job_scheduler.h"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+namespace vulkanbot
+{
+	JobScheduler::JobScheduler(unsigned int workers, size_t maxQueued)
+		: m_maxQueued(maxQueued), m_idle(std::max(workers, 1u))
+	{
+		for(unsigned int i=0; i<m_idle; i++)
+		{
+			m_workers.emplace_back(&JobScheduler::work, this);
+		}
+	}
+
+	JobScheduler::~JobScheduler()
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_all();
+		for(auto& worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	std::optional<size_t> JobScheduler::submit(JobPriority priority, std::function<void()> job)
+	{
+		size_t position;
+		{
+			std::unique_lock lock(m_mutex);
+			if(m_queued >= m_maxQueued)
+			{
+				m_rejected++;
+				return std::nullopt;
+			}
+
+			size_t index = static_cast<size_t>(priority);
+			size_t ahead = 0;
+			for(size_t i=0; i<=index; i++)
+				ahead += m_queues[i].size();
+			position = ahead >= m_idle ? ahead - m_idle + 1 : 0;
+
+			m_queues[index].push_back(std::move(job));
+			m_queued++;
+		}
+		m_condition.notify_one();
+		return position;
+	}
+
+	JobScheduler::Stats JobScheduler::stats() const
+	{
+		std::unique_lock lock(m_mutex);
+		return {m_queued, m_workers.size() - m_idle, m_completed, m_rejected};
+	}
+
+	void JobScheduler::work()
+	{
+		std::unique_lock lock(m_mutex);
+		while(true)
+		{
+			m_condition.wait(lock, [this](){ return m_stop || m_queued > 0; });
+			// jobs that have not started yet are dropped on shutdown
+			if(m_stop)
+				return;
+
+			auto queue = std::find_if(m_queues.begin(), m_queues.end(), [](const auto& q){ return !q.empty(); });
+			std::function<void()> job = std::move(queue->front());
+			queue->pop_front();
+			m_queued--;
+			m_idle--;
+
+			lock.unlock();
+			try
+			{
+				job();
+			}
+			catch(const std::exception& e)
+			{
+				std::cerr << "Job failed: " << e.what() << std::endl;
+			}
+			catch(...)
+			{
+				std::cerr << "Job failed with an unknown error" << std::endl;
+			}
+			lock.lock();
+			m_completed++;
+			m_idle++;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "bot.hpp"
+#include "discord_frontend.h"
+
+using namespace vulkanbot;
+
+// lock free, so the signal handler may set it
+static std::atomic_bool stop = false;
+
+void INThandler(int sig)
+{
+	stop = true;
+}
+
+int main(int argc, char** argv)
+{
+	std::signal(SIGINT, INThandler);
+	std::signal(SIGTERM, INThandler);
+
+	std::filesystem::path config_path;
+	if(argc > 1) {
+		config_path = argv[1];
+	} else if(const char* env = std::getenv("VULKAN_BOT_CONFIG")) {
+		config_path = env;
+	} else {
+		config_path = find_first_existing({
+			"/etc/vulkan_bot/config.json",
+			std::filesystem::current_path() / "config.json",
+		}).value_or("config.json");
+	}
+
+	nlohmann::json j;
+	{
+		std::ifstream config(config_path);
+		if(!config) {
+			std::cerr << "Could not open config file at " << config_path << std::endl;
+			return 1;
+		}
+		config >> j;
+	}
+
+	std::filesystem::path shaders_directory;
+	if(auto* path = std::getenv("VULKAN_BOT_SHADER_DIRECTORY")) {
+		shaders_directory = path;
+	}
+	else {
+		std::filesystem::path exe_directory = std::filesystem::canonical("/proc/self/exe").parent_path();
+		do {
+			if(std::filesystem::exists(shaders_directory = exe_directory / "shaders"))
+				break;
+			if(std::filesystem::exists(shaders_directory = exe_directory / ".." / "share" / "vulkan_bot" / "shaders"))
+				break;
+			if(std::filesystem::exists(shaders_directory = std::filesystem::current_path() / "shaders"))
+				break;
+
+			std::cerr << "Could not find shaders directory.\nYou can specify it using the enviornment variable VULKAN_BOT_SHADER_DIRECTORY." << std::endl;
+			return 2;
+		} while(false);
+	}
+
+	DiscordFrontend frontend(j);
+	VulkanBot bot(j, frontend.http_client());
+	std::cout << "Running bot...\n";
+	frontend.run(bot, stop);
+
+	// the bot finishes the jobs that are running and the backend saves its caches on the way out
+	std::cout << "Shutting down..." << std::endl;
+	return 0;
+}
@@ -0,0 +1,213 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace vulkanbot
+{
+	const std::vector<double> Metrics::defaultBounds = {
+		0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0, 120.0
+	};
+
+	Histogram::Histogram(std::vector<double> bounds) : m_bounds(std::move(bounds)),
+		m_buckets(std::make_unique<std::atomic_uint64_t[]>(m_bounds.size() + 1))
+	{
+	}
+
+	void Histogram::observe(double seconds)
+	{
+		size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), seconds) - m_bounds.begin();
+		m_buckets[bucket]++;
+		m_sum += seconds;
+		m_count++;
+	}
+
+	Metrics::Family& Metrics::family(const std::string& name, const std::string& type, const std::string& help)
+	{
+		Family& family = m_families[name];
+		if(family.type.empty())
+		{
+			family.type = type;
+			family.help = help;
+		}
+		else if(family.type != type)
+		{
+			throw std::logic_error("metric " + name + " registered as " + family.type + " and " + type);
+		}
+		return family;
+	}
+
+	Histogram& Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels)
+	{
+		std::unique_lock lock(m_mutex);
+		auto& histogram = family(name, "histogram", help).histograms[labels];
+		if(!histogram)
+			histogram = std::make_unique<Histogram>(defaultBounds);
+		return *histogram;
+	}
+
+	Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels)
+	{
+		std::unique_lock lock(m_mutex);
+		auto& counter = family(name, "counter", help).counters[labels];
+		if(!counter)
+			counter = std::make_unique<Counter>();
+		return *counter;
+	}
+
+	void Metrics::counter(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> value)
+	{
+		std::unique_lock lock(m_mutex);
+		family(name, "counter", help).callbacks[labels] = std::move(value);
+	}
+
+	void Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> value)
+	{
+		std::unique_lock lock(m_mutex);
+		family(name, "gauge", help).callbacks[labels] = std::move(value);
+	}
+
+	// name{labels,extra}, leaving out the braces if there is nothing to put in them
+	static std::string series(const std::string& name, const std::string& labels, const std::string& extra = {})
+	{
+		std::string all = labels.empty() ? extra : extra.empty() ? labels : labels + "," + extra;
+		return all.empty() ? name : name + "{" + all + "}";
+	}
+
+	std::string Metrics::render() const
+	{
+		std::ostringstream out;
+		out.precision(15);
+
+		std::unique_lock lock(m_mutex);
+		for(const auto& [name, family] : m_families)
+		{
+			out << "# HELP " << name << " " << family.help << "\n";
+			out << "# TYPE " << name << " " << family.type << "\n";
+			for(const auto& [labels, histogram] : family.histograms)
+			{
+				uint64_t cumulative = 0;
+				for(size_t i=0; i<histogram->m_bounds.size(); i++)
+				{
+					cumulative += histogram->m_buckets[i];
+					std::ostringstream bound;
+					bound << histogram->m_bounds[i];
+					out << series(name + "_bucket", labels, "le=\"" + bound.str() + "\"") << " " << cumulative << "\n";
+				}
+				cumulative += histogram->m_buckets[histogram->m_bounds.size()];
+				out << series(name + "_bucket", labels, "le=\"+Inf\"") << " " << cumulative << "\n";
+				out << series(name + "_sum", labels) << " " << histogram->m_sum.load() << "\n";
+				out << series(name + "_count", labels) << " " << histogram->m_count.load() << "\n";
+			}
+			for(const auto& [labels, counter] : family.counters)
+				out << series(name, labels) << " " << counter->m_value.load() << "\n";
+			for(const auto& [labels, value] : family.callbacks)
+				out << series(name, labels) << " " << value() << "\n";
+		}
+		return out.str();
+	}
+
+	MetricsServer::MetricsServer(const Metrics& metrics, const std::string& address, uint16_t port) : m_metrics(metrics)
+	{
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if(inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+			throw std::runtime_error("invalid metrics address " + address);
+
+		m_socket = socket(AF_INET, SOCK_STREAM, 0);
+		if(m_socket < 0)
+			throw std::runtime_error(std::string("cannot create metrics socket: ") + strerror(errno));
+		int reuse = 1;
+		setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if(bind(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(m_socket, 8) < 0)
+		{
+			std::string error = strerror(errno);
+			close(m_socket);
+			throw std::runtime_error("cannot listen on " + address + ":" + std::to_string(port) + ": " + error);
+		}
+
+		std::cout << "Serving metrics on http://" << address << ":" << port << "/metrics" << std::endl;
+		m_thread = std::thread(&MetricsServer::serve, this);
+	}
+
+	MetricsServer::~MetricsServer()
+	{
+		m_stop = true;
+		m_thread.join();
+		close(m_socket);
+	}
+
+	void MetricsServer::serve()
+	{
+		while(!m_stop)
+		{
+			// wake up regularly to notice m_stop
+			pollfd fd{m_socket, POLLIN, 0};
+			if(poll(&fd, 1, 250) <= 0)
+				continue;
+
+			int client = accept(m_socket, nullptr, nullptr);
+			if(client < 0)
+				continue;
+			// a scraper that stops reading must not hold up the server thread either
+			timeval timeout{1, 0};
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+			// only the request line matters, the rest of the request is ignored
+			std::string request;
+			char buffer[1024];
+			while(request.find("\r\n") == std::string::npos && request.size() < 8192)
+			{
+				ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+				if(n <= 0)
+					break;
+				request.append(buffer, n);
+			}
+
+			std::string status = "200 OK";
+			std::string body;
+			if(request.starts_with("GET /metrics ") || request.starts_with("GET /metrics?"))
+				body = m_metrics.render();
+			else
+			{
+				status = "404 Not Found";
+				body = "Not Found\n";
+			}
+
+			std::string response = "HTTP/1.1 " + status + "\r\n"
+				"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+				"Content-Length: " + std::to_string(body.size()) + "\r\n"
+				"Connection: close\r\n\r\n" + body;
+			for(size_t sent = 0; sent < response.size();)
+			{
+				ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+				if(n <= 0)
+					break;
+				sent += n;
+			}
+			close(client);
+		}
+	}
+
+	size_t residentMemory()
+	{
+		// the second field is the resident set in pages
+		std::ifstream statm("/proc/self/statm");
+		size_t size = 0, resident = 0;
+		if(!(statm >> size >> resident))
+			return 0;
+		return resident * sysconf(_SC_PAGESIZE);
+	}
+}
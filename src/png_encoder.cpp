@@ -0,0 +1,249 @@
+#include "png_encoder.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+namespace vulkanbot
+{
+	static constexpr size_t bytesPerPixel = 4;
+	// amount of filtered data deflated per task, every chunk is primed with the 32 KiB before it
+	static constexpr size_t chunkSize = 128*1024;
+	static constexpr size_t windowSize = 32*1024;
+
+	std::optional<PngCompression> parsePngCompression(const std::string& name)
+	{
+		if(name == "fast")
+			return PngCompression::Fast;
+		if(name == "default")
+			return PngCompression::Default;
+		if(name == "max")
+			return PngCompression::Max;
+		return std::nullopt;
+	}
+
+	// runs task(0) ... task(count-1) on up to threads threads, including the calling one
+	static void parallelFor(size_t count, unsigned int threads, const std::function<void(size_t)>& task)
+	{
+		std::atomic_size_t next = 0;
+		std::mutex errorMutex;
+		std::exception_ptr error;
+		auto work = [&](){
+			try
+			{
+				for(size_t i = next++; i < count; i = next++)
+					task(i);
+			}
+			catch(...)
+			{
+				std::unique_lock lock(errorMutex);
+				error = std::current_exception();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for(unsigned int i=1; i<std::min<size_t>(threads, count); i++)
+			workers.emplace_back(work);
+		work();
+		for(auto& worker : workers)
+			worker.join();
+
+		if(error)
+			std::rethrow_exception(error);
+	}
+
+	static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+	{
+		int p = a + b - c;
+		int pa = std::abs(p - a);
+		int pb = std::abs(p - b);
+		int pc = std::abs(p - c);
+		if(pa <= pb && pa <= pc)
+			return a;
+		return pb <= pc ? b : c;
+	}
+
+	// Tries every filter type on the row and keeps the one with the smallest sum of absolute values, like lodepng's default strategy.
+	static void filterRow(const uint8_t* row, const uint8_t* previous, size_t length, uint8_t* out,
+		std::array<std::vector<uint8_t>, 5>& candidates)
+	{
+		for(size_t i=0; i<length; i++)
+		{
+			uint8_t a = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+			uint8_t b = previous ? previous[i] : 0;
+			uint8_t c = previous && i >= bytesPerPixel ? previous[i - bytesPerPixel] : 0;
+			candidates[0][i] = row[i];
+			candidates[1][i] = row[i] - a;
+			candidates[2][i] = row[i] - b;
+			candidates[3][i] = row[i] - ((a + b) >> 1);
+			candidates[4][i] = row[i] - paeth(a, b, c);
+		}
+
+		size_t best = 0;
+		uint64_t bestSum = UINT64_MAX;
+		for(size_t type=0; type<candidates.size(); type++)
+		{
+			uint64_t sum = 0;
+			for(uint8_t v : candidates[type])
+				sum += v < 128 ? v : 256 - v;
+			if(sum < bestSum)
+			{
+				bestSum = sum;
+				best = type;
+			}
+		}
+
+		out[0] = static_cast<uint8_t>(best);
+		memcpy(out + 1, candidates[best].data(), length);
+	}
+
+	static std::string deflateChunk(const uint8_t* data, size_t offset, size_t length, bool last, int level)
+	{
+		z_stream stream{};
+		// raw deflate, the zlib header and checksum are written once for the whole stream
+		if(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			throw std::runtime_error("deflateInit2 failed");
+
+		if(offset > 0)
+		{
+			size_t dictionary = std::min(offset, windowSize);
+			deflateSetDictionary(&stream, data + offset - dictionary, dictionary);
+		}
+
+		std::string out(deflateBound(&stream, length) + 16, '\0');
+		stream.next_in = const_cast<uint8_t*>(data + offset);
+		stream.avail_in = length;
+		stream.next_out = reinterpret_cast<uint8_t*>(out.data());
+		stream.avail_out = out.size();
+
+		// every chunk but the last ends on a byte boundary with a sync flush, so the chunks can simply be concatenated
+		int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+		int result;
+		while(true)
+		{
+			result = deflate(&stream, flush);
+			if(last ? result == Z_STREAM_END : stream.avail_out > 0)
+				break;
+			if(result != Z_OK && result != Z_BUF_ERROR)
+				break;
+
+			size_t used = out.size() - stream.avail_out;
+			out.resize(out.size() * 2);
+			stream.next_out = reinterpret_cast<uint8_t*>(out.data() + used);
+			stream.avail_out = out.size() - used;
+		}
+		out.resize(out.size() - stream.avail_out);
+		deflateEnd(&stream);
+
+		if(last ? result != Z_STREAM_END : result != Z_OK)
+			throw std::runtime_error("deflate failed");
+		return out;
+	}
+
+	static void writeUint32(std::string& out, uint32_t value)
+	{
+		out += static_cast<char>(value >> 24);
+		out += static_cast<char>(value >> 16);
+		out += static_cast<char>(value >> 8);
+		out += static_cast<char>(value);
+	}
+
+	static void writeChunk(std::string& out, const char* type, const std::string& data)
+	{
+		writeUint32(out, data.size());
+		size_t start = out.size();
+		out.append(type, 4);
+		out += data;
+		writeUint32(out, crc32(0L, reinterpret_cast<const Bytef*>(out.data() + start), out.size() - start));
+	}
+
+	std::string encodePng(const uint8_t* rgba, uint32_t width, uint32_t height, PngCompression compression, unsigned int threads)
+	{
+		if(threads == 0)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+		int level;
+		std::string zlibHeader;
+		switch(compression)
+		{
+			case PngCompression::Fast:		level = 1; zlibHeader = "\x78\x01"; break;
+			case PngCompression::Max:		level = 9; zlibHeader = "\x78\xda"; break;
+			case PngCompression::Default:
+			default:						level = 6; zlibHeader = "\x78\x9c"; break;
+		}
+
+		size_t rowLength = static_cast<size_t>(width) * bytesPerPixel;
+		size_t filteredRowLength = rowLength + 1;
+		size_t filteredSize = filteredRowLength * height;
+
+		std::vector<uint8_t> filtered(filteredSize);
+		size_t bands = std::min<size_t>(height, threads * 4);
+		parallelFor(bands, threads, [&](size_t band){
+			std::array<std::vector<uint8_t>, 5> candidates;
+			for(auto& candidate : candidates)
+				candidate.resize(rowLength);
+			for(size_t y = band * height / bands; y < (band + 1) * height / bands; y++)
+			{
+				const uint8_t* row = rgba + y * rowLength;
+				filterRow(row, y > 0 ? row - rowLength : nullptr, rowLength, filtered.data() + y * filteredRowLength, candidates);
+			}
+		});
+
+		size_t chunks = std::max<size_t>((filteredSize + chunkSize - 1) / chunkSize, 1);
+		std::vector<std::string> compressed(chunks);
+		std::vector<uLong> checksums(chunks);
+		parallelFor(chunks, threads, [&](size_t chunk){
+			size_t offset = chunk * chunkSize;
+			size_t length = std::min(chunkSize, filteredSize - offset);
+			compressed[chunk] = deflateChunk(filtered.data(), offset, length, chunk == chunks - 1, level);
+			checksums[chunk] = adler32(adler32(0L, Z_NULL, 0), filtered.data() + offset, length);
+		});
+
+		uLong checksum = checksums[0];
+		size_t compressedSize = compressed[0].size();
+		for(size_t chunk=1; chunk<chunks; chunk++)
+		{
+			size_t length = std::min(chunkSize, filteredSize - chunk * chunkSize);
+			checksum = adler32_combine(checksum, checksums[chunk], length);
+			compressedSize += compressed[chunk].size();
+		}
+
+		std::string ihdr;
+		writeUint32(ihdr, width);
+		writeUint32(ihdr, height);
+		ihdr += '\x08';	// bit depth
+		ihdr += '\x06';	// RGBA
+		ihdr += '\0';	// deflate
+		ihdr += '\0';	// adaptive filtering
+		ihdr += '\0';	// no interlace
+
+		uint32_t idatSize = zlibHeader.size() + compressedSize + 4;
+		std::string png;
+		png.reserve(8 + (12 + ihdr.size()) + (12 + idatSize) + 12);
+		png.append("\x89PNG\r\n\x1a\n", 8);
+		writeChunk(png, "IHDR", ihdr);
+
+		// the IDAT is assembled in place, it is by far the largest part of the file
+		writeUint32(png, idatSize);
+		size_t idatStart = png.size();
+		png.append("IDAT", 4);
+		png += zlibHeader;
+		for(const std::string& chunk : compressed)
+			png += chunk;
+		writeUint32(png, checksum);
+		writeUint32(png, crc32(0L, reinterpret_cast<const Bytef*>(png.data() + idatStart), png.size() - idatStart));
+
+		writeChunk(png, "IEND", {});
+		return png;
+	}
+}
@@ -1,57 +1,104 @@
 #include "bot.hpp"
 
-#include <lodepng.h>
 #include <glm/gtx/string_cast.hpp>
 
 namespace vulkanbot {
 
-void VulkanBot::do_render(const dpp::interaction_create_t& event, const dpp::message& message, const shader& vert, const shader& frag, const std::string& texture, std::optional<animation> animation) {
-    event.thinking();
+void VulkanBot::do_render(Interaction& interaction, const shader& vert, const shader& frag, const std::string& texture,
+    int width, int height, std::optional<animation> animation) {
+    auto started = std::chrono::steady_clock::now();
+    // the download runs while the shaders compile, only the upload and rendering need a context
+    auto decoded = fetch_texture(texture);
 
-    std::cout << "Acquiring render lock..." << std::endl;
-    std::unique_lock lock(render_lock);
-    std::cout << "Start rendering..." << std::endl;
+    PipelineResult pipeline = backend.createShaderMixPipeline(vert.data, vert.file, frag.data, frag.file, vk::CullModeFlagBits::eFront, true);
+    if(!pipeline.success) {
+        fail(interaction, "Error failed to upload shaders: "+pipeline.error);
+        return;
+    }
+    stage("compile").observeMicroseconds(pipeline.compileTime);
+    stage("pipeline").observeMicroseconds(pipeline.pipelineTime);
 
-    auto [result, error] = backend.uploadShaderMix(vert.data, vert.file, frag.data, frag.file, vk::CullModeFlagBits::eFront, true);
-    if(!result) {
-        event.edit_response("Error failed to upload shaders: "+error);
+    std::shared_ptr<const DecodedTexture> decodedTexture = decoded.get();
+    if(!decodedTexture) {
+        fail(interaction, "Error: failed to decode texture");
         return;
     }
-    std::promise<std::string> p;
-    std::future<std::string> f = p.get_future();
-    bot.request(texture, dpp::http_method::m_get, [&p](const dpp::http_request_completion_t& c)mutable{
-        p.set_value(c.body);
-    });
 
-    std::vector<unsigned char> image;
-    unsigned int w, h;
-    auto body = f.get();
-    lodepng::decode(image, w, h, reinterpret_cast<unsigned char*>(body.data()), body.size());
-    std::unique_ptr<ImageData> vkImage = backend.uploadImage(w, h, image);
+    // declared before the context, so on the way out the context is released (and done with the texture) first
+    std::shared_ptr<ImageData> vkImage;
+    std::cout << "Acquiring render context..." << std::endl;
+    auto t1 = std::chrono::steady_clock::now();
+    std::shared_ptr<RenderContext> context = backend.acquireContext();
+    stage("context_wait").observe(secondsSince(t1));
+    std::cout << "Start rendering on context " << context->index() << "..." << std::endl;
 
-    backend.buildCommandBuffer(nullptr, animation.has_value());
+    context->usePipeline(std::move(pipeline.pipeline), pipeline.fullscreen);
+    vkImage = bind_texture(*context, decodedTexture);
+
+    // the preview of an image uses the same random value, so it shows what the full render will look like
+    float random = next_random();
+    if(m_preview) {
+        do_render_preview(interaction, *context, width, height, animation ? animation->tStart : 0.0f, random, started);
+    }
+    context->setExtent(width, height);
 
+    FrameFormat format = FrameFormat::RGBA;
     if(animation) {
-        do_render_animation_internal(event, *animation);
+        // GIF gets palette indices, WebP and MP4 YUV
+        if(animation->format == "gif")
+            format = FrameFormat::PAL8;
+        else
+            format = animation->format == "mp4" && m_nv12 ? FrameFormat::NV12 : FrameFormat::YUV420P;
+    }
+    context->buildCommandBuffer(nullptr, format);
+
+    if(animation) {
+        do_render_animation_internal(interaction, *context, *animation);
     }
     else {
-        backend.updateUniformObject([this](UniformBufferObject* ubo){
-            ubo->time = 0.0f;
-            ubo->random = dist(e2);
-        });
+        context->setUniformObject({.time = 0.0f, .random = random});
 
-        backend.renderFrame([this, event](uint8_t* data, vk::DeviceSize size, int width, int height, vk::Result result, long time)
+        context->renderFrame([this, &interaction](uint8_t* data, vk::DeviceSize size, int width, int height, vk::Result result, long time,
+            const GpuTimings& timings)
         {
-            std::vector<unsigned char> imageBytes(data, data + size);
-            std::vector<unsigned char> png;
-            lodepng::encode(png, imageBytes, width, height);
+            stage("gpu").observeMicroseconds(time);
+            observe_gpu(timings);
 
-            dpp::message msg({}, "Rendering finished in "+std::to_string(time)+" μs!");
-            msg.add_file("render.png", std::string(png.begin(), png.end()));
-            event.edit_response(msg);
+            // encoded straight from the mapped readback, the result is moved into the message without further copies
+            auto t1 = std::chrono::steady_clock::now();
+            std::vector<Attachment> attachments;
+            attachments.push_back({"render.png", encodePng(data, width, height, m_pngCompression, m_imageThreads), "image/png"});
+            stage("image_encode").observe(secondsSince(t1));
+            interaction.edit_response("Rendering finished in "+std::to_string(time)+" μs!", std::move(attachments));
         });
     }
     std::cout << "Rendering finished!" << std::endl;
 }
 
+void VulkanBot::do_render_preview(Interaction& interaction, RenderContext& context, int width, int height, float time, float random,
+    std::chrono::steady_clock::time_point started) {
+    if(secondsSince(started) > m_previewBudget) {
+        return;
+    }
+
+    // same pipeline and texture, the viewport is dynamic, so all it takes is a small draw and a small PNG
+    context.setExtent(std::max(width / m_previewDivisor, 1), std::max(height / m_previewDivisor, 1));
+    context.buildCommandBuffer(nullptr, FrameFormat::RGBA);
+    context.setUniformObject({.time = time, .random = random});
+
+    context.renderFrame([this, &interaction, started](uint8_t* data, vk::DeviceSize size, int width, int height, vk::Result result, long time,
+        const GpuTimings& timings)
+    {
+        // a preview that shows up late only delays the full result
+        if(secondsSince(started) > m_previewBudget) {
+            return;
+        }
+
+        std::vector<Attachment> attachments;
+        attachments.push_back({"preview.png", encodePng(data, width, height, PngCompression::Fast, m_imageThreads), "image/png"});
+        interaction.edit_response("Preview, rendering in full...", std::move(attachments));
+        stage("preview").observe(secondsSince(started));
+    });
+}
+
 }
@@ -0,0 +1,296 @@
+#include "shader_cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <openssl/evp.h>
+
+namespace vulkanbot
+{
+	// bump whenever the compiler settings in compileShader change, so old entries are not reused
+	static constexpr const char* cacheVersion = "vulkanbot-spirv-1 vulkan1.1 spv1.3";
+	static constexpr uint32_t spirvMagic = 0x07230203;
+
+	static std::string normalizeSource(const std::string& source)
+	{
+		std::string normalized;
+		normalized.reserve(source.size());
+
+		std::istringstream stream(source);
+		std::string line;
+		while(std::getline(stream, line))
+		{
+			if(!line.empty() && line.back() == '\r')
+				line.pop_back();
+			size_t end = line.find_last_not_of(" \t");
+			// keep trailing whitespace after a backslash, removing it would turn the line into a continuation
+			if(end != std::string::npos && line[end] != '\\')
+				line.erase(end + 1);
+			else if(end == std::string::npos)
+				line.clear();
+			normalized += line;
+			normalized += '\n';
+		}
+		return normalized;
+	}
+
+	static std::optional<std::string> readText(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if(!file)
+			return std::nullopt;
+		std::ostringstream buffer;
+		buffer << file.rdbuf();
+		return buffer.str();
+	}
+
+	// Collects every file reachable through #include "..." using the same resolution rules as LimitedIncluder.
+	// Directives inside inactive #if blocks are included as well, which only makes the key more specific.
+	static void collectIncludes(const std::string& source, const std::filesystem::path& includePath,
+		std::map<std::string, std::optional<std::string>>& includes, int depth = 0)
+	{
+		if(depth > 32)
+			return;
+
+		std::istringstream stream(source);
+		std::string line;
+		while(std::getline(stream, line))
+		{
+			size_t pos = line.find_first_not_of(" \t");
+			if(pos == std::string::npos || line[pos] != '#')
+				continue;
+			pos = line.find_first_not_of(" \t", pos + 1);
+			if(pos == std::string::npos || line.compare(pos, 7, "include") != 0)
+				continue;
+			size_t begin = line.find('"', pos + 7);
+			if(begin == std::string::npos)
+				continue;
+			size_t end = line.find('"', begin + 1);
+			if(end == std::string::npos)
+				continue;
+
+			std::string name = line.substr(begin + 1, end - begin - 1);
+			if(name.find("../") != std::string::npos || includes.contains(name))
+				continue;
+
+			std::optional<std::string> content = readText(includePath / name);
+			includes[name] = content;
+			if(content)
+				collectIncludes(*content, includePath, includes, depth + 1);
+		}
+	}
+
+	ShaderCache::ShaderCache(std::optional<std::filesystem::path> directory, size_t maxMemoryBytes, size_t maxDiskBytes)
+		: m_directory(directory), m_maxMemoryBytes(maxMemoryBytes), m_maxDiskBytes(maxDiskBytes)
+	{
+		if(m_directory)
+		{
+			std::error_code ec;
+			std::filesystem::create_directories(*m_directory, ec);
+			if(ec)
+			{
+				std::cerr << "Cannot create shader cache directory " << *m_directory << ": " << ec.message() << std::endl;
+				m_directory = std::nullopt;
+				return;
+			}
+
+			for(const auto& entry : std::filesystem::directory_iterator(*m_directory, ec))
+			{
+				if(entry.path().extension() == ".spv")
+					m_diskBytes += entry.file_size(ec);
+			}
+		}
+	}
+
+	std::string ShaderCache::key(EShLanguage stage, const std::string& source, const std::filesystem::path& includePath) const
+	{
+		std::string normalized = normalizeSource(source);
+		std::map<std::string, std::optional<std::string>> includes;
+		collectIncludes(normalized, includePath, includes);
+
+		EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+		EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+		auto update = [ctx](const std::string& data) {
+			uint64_t size = data.size();
+			EVP_DigestUpdate(ctx, &size, sizeof(size));
+			EVP_DigestUpdate(ctx, data.data(), data.size());
+		};
+
+		update(cacheVersion);
+		update(std::to_string(static_cast<int>(stage)));
+		update(normalized);
+		for(const auto& [name, content] : includes)
+		{
+			update(name);
+			update(content.value_or(std::string("\0missing", 8)));
+		}
+
+		unsigned char digest[EVP_MAX_MD_SIZE];
+		unsigned int length = 0;
+		EVP_DigestFinal_ex(ctx, digest, &length);
+		EVP_MD_CTX_free(ctx);
+
+		static constexpr char hex[] = "0123456789abcdef";
+		std::string key;
+		for(unsigned int i=0; i<length; i++)
+		{
+			key += hex[digest[i] >> 4];
+			key += hex[digest[i] & 0xf];
+		}
+		return key;
+	}
+
+	bool ShaderCache::lookup(const std::string& key, std::vector<unsigned int>& spirv)
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			auto it = m_index.find(key);
+			if(it != m_index.end())
+			{
+				m_entries.splice(m_entries.begin(), m_entries, it->second);
+				spirv = it->second->second;
+				m_memoryHits++;
+				return true;
+			}
+		}
+
+		if(m_directory)
+		{
+			std::ifstream file(*m_directory / (key + ".spv"), std::ios::binary | std::ios::ate);
+			if(file)
+			{
+				size_t size = file.tellg();
+				if(size > 0 && size % sizeof(unsigned int) == 0)
+				{
+					std::vector<unsigned int> code(size / sizeof(unsigned int));
+					file.seekg(0);
+					file.read(reinterpret_cast<char*>(code.data()), size);
+					if(file && code[0] == spirvMagic)
+					{
+						// so eviction goes by when an entry was last used, not when it was written
+						std::error_code ec;
+						std::filesystem::last_write_time(*m_directory / (key + ".spv"), std::filesystem::file_time_type::clock::now(), ec);
+
+						std::unique_lock lock(m_mutex);
+						insert(key, code);
+						m_diskHits++;
+						spirv = std::move(code);
+						return true;
+					}
+				}
+			}
+		}
+
+		std::unique_lock lock(m_mutex);
+		m_misses++;
+		return false;
+	}
+
+	void ShaderCache::store(const std::string& key, const std::vector<unsigned int>& spirv)
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			insert(key, spirv);
+		}
+
+		if(m_directory)
+		{
+			// write to a temporary file first, so a concurrent reader never sees a partial entry
+			std::filesystem::path path = *m_directory / (key + ".spv");
+			std::filesystem::path temp = path;
+			temp += ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+			{
+				std::ofstream file(temp, std::ios::binary);
+				file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(unsigned int));
+				if(!file)
+				{
+					std::cerr << "Cannot write shader cache entry " << temp << std::endl;
+					return;
+				}
+			}
+			std::unique_lock lock(m_diskMutex);
+			std::error_code ec;
+			uintmax_t replaced = std::filesystem::exists(path, ec) ? std::filesystem::file_size(path, ec) : 0;
+			if(ec)
+				replaced = 0;
+			std::filesystem::rename(temp, path, ec);
+			if(ec)
+			{
+				std::filesystem::remove(temp, ec);
+				return;
+			}
+			m_diskBytes = m_diskBytes - std::min<size_t>(m_diskBytes, replaced) + spirv.size() * sizeof(unsigned int);
+			if(m_diskBytes > m_maxDiskBytes)
+				evictFiles(path);
+		}
+	}
+
+	void ShaderCache::evictFiles(const std::filesystem::path& keep)
+	{
+		struct File {
+			std::filesystem::path path;
+			std::filesystem::file_time_type time;
+			uintmax_t size;
+		};
+		std::vector<File> files;
+		size_t total = 0;
+
+		std::error_code ec;
+		for(const auto& entry : std::filesystem::directory_iterator(*m_directory, ec))
+		{
+			if(entry.path().extension() != ".spv" || entry.path() == keep)
+				continue;
+			std::error_code fileEc;
+			File file{entry.path(), entry.last_write_time(fileEc), entry.file_size(fileEc)};
+			if(fileEc)
+				continue;
+			total += file.size;
+			files.push_back(std::move(file));
+		}
+		std::error_code keepEc;
+		total += std::filesystem::file_size(keep, keepEc);
+
+		std::sort(files.begin(), files.end(), [](const File& a, const File& b){ return a.time < b.time; });
+		for(const File& file : files)
+		{
+			if(total <= m_maxDiskBytes)
+				break;
+			if(std::filesystem::remove(file.path, ec))
+				total -= file.size;
+		}
+		// recounted, other processes sharing the directory might have changed it in the meantime
+		m_diskBytes = total;
+	}
+
+	ShaderCache::Stats ShaderCache::stats() const
+	{
+		std::unique_lock lock(m_mutex);
+		return {m_memoryHits, m_diskHits, m_misses, m_entries.size(), m_bytes};
+	}
+
+	void ShaderCache::insert(const std::string& key, const std::vector<unsigned int>& spirv)
+	{
+		auto it = m_index.find(key);
+		if(it != m_index.end())
+		{
+			m_entries.splice(m_entries.begin(), m_entries, it->second);
+			return;
+		}
+
+		m_entries.emplace_front(key, spirv);
+		m_index[key] = m_entries.begin();
+		m_bytes += spirv.size() * sizeof(unsigned int);
+
+		while(m_bytes > m_maxMemoryBytes && m_entries.size() > 1)
+		{
+			auto& last = m_entries.back();
+			m_bytes -= last.second.size() * sizeof(unsigned int);
+			m_index.erase(last.first);
+			m_entries.pop_back();
+		}
+	}
+}
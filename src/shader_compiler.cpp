@@ -0,0 +1,131 @@
+#include "shader_compiler.h"
+
+#include <glslang/Public/ResourceLimits.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+
+#include "LimitedIncluder.h"
+
+namespace vulkanbot
+{
+	static std::tuple<bool, std::string> compileShader(EShLanguage stage, std::string glslCode, std::vector<unsigned int>& shaderCode, const std::filesystem::path& includePath)
+	{
+		vulkan_bot::LimitedIncluder includer(includePath);
+
+		const char * shaderStrings[1];
+		shaderStrings[0] = glslCode.data();
+
+		glslang::TShader shader(stage);
+		shader.setStrings(shaderStrings, 1);
+		shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 100);
+		shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetClientVersion::EShTargetVulkan_1_1);
+		shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_3);
+		shader.setEntryPoint("main");
+		shader.setSourceEntryPoint("main");
+
+		EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
+		if(!shader.parse(GetDefaultResources(), 100, false, messages, includer))
+		{
+			return {false, std::string(shader.getInfoLog())};
+		}
+
+		glslang::TProgram program;
+		program.addShader(&shader);
+		if(!program.link(messages))
+		{
+			return {false, std::string(program.getInfoLog())};
+		}
+		glslang::GlslangToSpv(*program.getIntermediate(stage), shaderCode);
+
+		return {true, ""};
+	}
+
+	// glslang keeps process wide state, it is set up with the first compiler and torn down when the process exits,
+	// not with every compiler that comes and goes
+	static void initializeGlslang()
+	{
+		struct Process {
+			Process() { glslang::InitializeProcess(); }
+			~Process() { glslang::FinalizeProcess(); }
+		};
+		static Process process;
+	}
+
+	ShaderCompiler::ShaderCompiler(const std::filesystem::path& includePath, std::unique_ptr<ShaderCache> cache, unsigned int threads)
+		: m_includePath(includePath), m_cache(std::move(cache))
+	{
+		initializeGlslang();
+
+		if(threads == 0)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		for(unsigned int i=0; i<threads; i++)
+		{
+			m_workers.emplace_back(&ShaderCompiler::work, this);
+		}
+	}
+
+	ShaderCompiler::~ShaderCompiler()
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_all();
+		for(auto& worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	std::future<CompileResult> ShaderCompiler::compile(EShLanguage stage, std::string source)
+	{
+		auto task = std::make_shared<std::packaged_task<CompileResult()>>([this, stage, source = std::move(source)](){
+			return compileNow(stage, source);
+		});
+		std::future<CompileResult> future = task->get_future();
+		{
+			std::unique_lock lock(m_mutex);
+			m_tasks.push([task](){ (*task)(); });
+		}
+		m_condition.notify_one();
+		return future;
+	}
+
+	ShaderCache::Stats ShaderCompiler::cacheStats() const
+	{
+		return m_cache->stats();
+	}
+
+	CompileResult ShaderCompiler::compileNow(EShLanguage stage, const std::string& source)
+	{
+		CompileResult result{};
+
+		std::string key = m_cache->key(stage, source, m_includePath);
+		if(m_cache->lookup(key, result.spirv))
+		{
+			result.success = true;
+			return result;
+		}
+
+		std::tie(result.success, result.error) = compileShader(stage, source, result.spirv, m_includePath);
+		if(result.success)
+			m_cache->store(key, result.spirv);
+		return result;
+	}
+
+	void ShaderCompiler::work()
+	{
+		while(true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock lock(m_mutex);
+				m_condition.wait(lock, [this](){ return m_stop || !m_tasks.empty(); });
+				if(m_stop && m_tasks.empty())
+					return;
+				task = std::move(m_tasks.front());
+				m_tasks.pop();
+			}
+			task();
+		}
+	}
+}
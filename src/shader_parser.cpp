@@ -0,0 +1,129 @@
+#include "shader_parser.h"
+
+#include <filesystem>
+#include <sstream>
+
+namespace vulkanbot {
+	std::vector<shader> find_shaders(const std::string& message, shader_type default_type) {
+		std::vector<shader> shaders{};
+
+		std::string::size_type pos = 0;
+		while(pos < message.size() && pos != std::string::npos) {
+			pos = message.find("``", pos);
+			if(pos == std::string::npos) {
+				break;
+			}
+
+			shader shader = {.type = shader_type::unknown};
+			if(pos >= 4) {
+				std::string t = message.substr(pos-4, 4);
+				if(t == "vert") {
+					shader.type = shader_type::vert;
+				} else if(t == "frag") {
+					shader.type = shader_type::frag;
+				} else if(t == "comp") {
+					shader.type = shader_type::comp;
+				}
+			}
+
+			std::string quotes = message.substr(pos, 3);
+			if(quotes == "```") {
+				pos = message.find("\n", pos);
+				auto begin = pos+1;
+
+				pos = message.find("```", pos);
+
+				std::string code = message.substr(begin, pos-begin);
+				pos += 3;
+
+				shader.data = code;
+				shader.file = false;
+				if(shader.type == shader_type::unknown) {
+					if(code.contains("gl_Position")) {
+						shader.type = shader_type::vert;
+					} else {
+						shader.type = default_type;
+					}
+				}
+			} else {
+				pos += 2;
+
+				auto begin = pos;
+				pos = message.find("``", pos);
+
+				std::string file = message.substr(begin, pos-begin);
+				pos += 2;
+
+				std::filesystem::path p(file);
+				shader.data = p;
+				shader.file = true;
+
+				if(shader.type == shader_type::unknown) {
+					auto t = p.extension().string();
+					if(t == "vert") {
+						shader.type = shader_type::vert;
+					} else if(t == "frag") {
+						shader.type = shader_type::frag;
+					} else if(t == "comp") {
+						shader.type = shader_type::comp;
+					} else {
+						shader.type = default_type;
+					}
+				}
+			}
+			shaders.push_back(shader);
+		}
+		return shaders;
+	}
+
+	std::optional<animation> find_animation(const std::string& message) {
+		std::istringstream lines(message);
+		std::string line;
+		while(std::getline(lines, line)) {
+			if(!line.starts_with("animated ")) {
+				continue;
+			}
+
+			std::istringstream values(line.substr(9));
+			animation a{};
+			if(!(values >> a.frames >> a.fps) || a.frames <= 0 || a.fps <= 0) {
+				return std::nullopt;
+			}
+			a.tStart = 0.0f;
+			a.tEnd = 1.0f;
+			if(values >> a.tStart >> a.tEnd) {
+				std::string bitrate;
+				if(values >> bitrate) {
+					long factor = 1;
+					if(bitrate.ends_with("k")) {
+						factor = 1000;
+					} else if(bitrate.ends_with("M")) {
+						factor = 1000000;
+					}
+					a.bitrate = std::atol(bitrate.c_str()) * factor;
+				}
+			}
+			return a;
+		}
+		return std::nullopt;
+	}
+
+	std::optional<std::pair<int, int>> find_size(const std::string& message) {
+		std::istringstream lines(message);
+		std::string line;
+		while(std::getline(lines, line)) {
+			if(!line.starts_with("size ")) {
+				continue;
+			}
+
+			std::istringstream values(line.substr(5));
+			int width, height;
+			char x;
+			if(!(values >> width >> x >> height) || x != 'x' || width <= 0 || height <= 0) {
+				return std::nullopt;
+			}
+			return std::pair{width, height};
+		}
+		return std::nullopt;
+	}
+}
@@ -0,0 +1,170 @@
+#include "staging_ring.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace vulkanbot
+{
+	static vk::DeviceSize alignUp(vk::DeviceSize n, vk::DeviceSize alignment)
+	{
+		return (n + alignment - 1) / alignment * alignment;
+	}
+
+	StagingRing::StagingRing(DeviceAllocator& allocator, vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize size)
+		: m_allocator(allocator), m_device(device), m_size(size)
+	{
+		// copies into images want their source offset to be a multiple of the texel size as well, 16 covers every format
+		m_alignment = std::max<vk::DeviceSize>(16, physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment);
+
+		m_buffer = m_device.createBufferUnique(vk::BufferCreateInfo({}, m_size, vk::BufferUsageFlagBits::eTransferSrc));
+		m_allocation = m_allocator.allocate(m_buffer.get(),
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, {}, AllocationStrategy::Linear);
+	}
+
+	StagingRing::Region StagingRing::acquire(vk::DeviceSize size)
+	{
+		size = std::max<vk::DeviceSize>(size, 1);
+		if(size > m_size)
+		{
+			std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+			entry->buffer = m_device.createBufferUnique(vk::BufferCreateInfo({}, size, vk::BufferUsageFlagBits::eTransferSrc));
+			entry->allocation = m_allocator.allocate(entry->buffer.get(),
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+			entry->begin = 0;
+			entry->end = size;
+
+			std::unique_lock lock(m_mutex);
+			reclaim();
+			entry->id = m_nextId++;
+			entry->fence = takeFence();
+			Region region{entry->buffer.get(), 0, size, entry->allocation.data(), entry->fence, entry->id};
+			m_entries.push_back(std::move(entry));
+			m_oversized++;
+			return region;
+		}
+
+		std::unique_lock lock(m_mutex);
+		reclaim();
+		std::optional<vk::DeviceSize> offset;
+		while(!(offset = fit(size)))
+		{
+			m_waits++;
+			Entry& oldest = *m_entries.front();
+			if(oldest.released)
+			{
+				if(m_device.waitForFences(oldest.fence, true, UINT64_MAX) != vk::Result::eSuccess)
+					throw std::runtime_error("waiting for a staging region failed");
+			}
+			else
+			{
+				m_released.wait(lock);
+			}
+			reclaim();
+		}
+
+		std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+		entry->id = m_nextId++;
+		entry->begin = *offset;
+		entry->end = *offset + size;
+		entry->fence = takeFence();
+		m_head = entry->end;
+
+		Region region{m_buffer.get(), *offset, size, m_allocation.data() + *offset, entry->fence, entry->id};
+		m_entries.push_back(std::move(entry));
+		return region;
+	}
+
+	void StagingRing::release(const Region& region, bool submitted)
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			auto it = std::find_if(m_entries.begin(), m_entries.end(), [&region](const std::unique_ptr<Entry>& e){
+				return e->id == region.id;
+			});
+			if(it == m_entries.end())
+				return;
+			(*it)->released = true;
+			(*it)->submitted = submitted;
+			reclaim();
+		}
+		m_released.notify_all();
+	}
+
+	void StagingRing::wait(const Region& region)
+	{
+		std::unique_lock lock(m_mutex);
+		auto it = std::find_if(m_entries.begin(), m_entries.end(), [&region](const std::unique_ptr<Entry>& e){
+			return e->id == region.id;
+		});
+		// already reclaimed, or nothing was submitted with it
+		if(it == m_entries.end() || !(*it)->released || !(*it)->submitted)
+			return;
+		// with the lock held, so the fence cannot be reset and reused in the meantime
+		if(m_device.waitForFences((*it)->fence, true, UINT64_MAX) != vk::Result::eSuccess)
+			throw std::runtime_error("waiting for a staging region failed");
+		reclaim();
+	}
+
+	std::optional<vk::DeviceSize> StagingRing::fit(vk::DeviceSize size) const
+	{
+		// the oldest region in the ring is where the free space ends
+		auto oldest = std::find_if(m_entries.begin(), m_entries.end(), [](const std::unique_ptr<Entry>& e){ return !e->buffer; });
+		if(oldest == m_entries.end())
+			return 0;
+
+		vk::DeviceSize tail = (*oldest)->begin;
+		vk::DeviceSize offset = alignUp(m_head, m_alignment);
+		if(m_head > tail)
+		{
+			// the regions are in one piece, there is space after them and before them once the ring wraps around
+			if(offset + size <= m_size)
+				return offset;
+			if(size <= tail)
+				return 0;
+			return std::nullopt;
+		}
+		// wrapped around, the space is between the newest and the oldest region
+		if(offset + size <= tail)
+			return offset;
+		return std::nullopt;
+	}
+
+	void StagingRing::reclaim()
+	{
+		while(!m_entries.empty())
+		{
+			Entry& entry = *m_entries.front();
+			if(!entry.released)
+				break;
+			if(entry.submitted)
+			{
+				if(m_device.getFenceStatus(entry.fence) != vk::Result::eSuccess)
+					break;
+				m_device.resetFences(entry.fence);
+			}
+			m_idleFences.push_back(entry.fence);
+			m_entries.pop_front();
+		}
+	}
+
+	vk::Fence StagingRing::takeFence()
+	{
+		if(m_idleFences.empty())
+		{
+			m_fences.push_back(m_device.createFenceUnique(vk::FenceCreateInfo()));
+			return m_fences.back().get();
+		}
+		vk::Fence fence = m_idleFences.back();
+		m_idleFences.pop_back();
+		return fence;
+	}
+
+	StagingRing::Stats StagingRing::stats() const
+	{
+		std::unique_lock lock(m_mutex);
+		Stats stats{m_size, 0, m_waits, m_oversized};
+		for(const auto& entry : m_entries)
+			stats.usedBytes += entry->end - entry->begin;
+		return stats;
+	}
+}
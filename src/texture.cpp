@@ -0,0 +1,57 @@
+#include "bot.hpp"
+
+#include <lodepng.h>
+
+namespace vulkanbot {
+
+std::vector<unsigned char> VulkanBot::download_image(const std::string& url) {
+    std::string body = http->get(url);
+    return std::vector<unsigned char>(body.begin(), body.end());
+}
+
+std::shared_future<std::shared_ptr<const DecodedTexture>> VulkanBot::fetch_texture(const std::string& url) {
+    if(std::shared_ptr<const DecodedTexture> texture = texture_cache->findDecoded(url)) {
+        std::promise<std::shared_ptr<const DecodedTexture>> p;
+        p.set_value(texture);
+        return p.get_future().share();
+    }
+
+    // unlike the future of std::async, this one does not block in its destructor when a job gives up early
+    auto task = std::make_shared<std::packaged_task<std::shared_ptr<const DecodedTexture>()>>([this, url]() -> std::shared_ptr<const DecodedTexture> {
+        auto t1 = std::chrono::steady_clock::now();
+        std::vector<unsigned char> png = download_image(url);
+        stage("texture_fetch").observe(secondsSince(t1));
+
+        auto t2 = std::chrono::steady_clock::now();
+        std::vector<unsigned char> pixels;
+        unsigned int w, h;
+        if(unsigned int error = lodepng::decode(pixels, w, h, png)) {
+            std::cerr << "Failed to decode texture " << url << ": " << lodepng_error_text(error) << std::endl;
+            return nullptr;
+        }
+        stage("texture_decode").observe(secondsSince(t2));
+        return texture_cache->storeDecoded(url, w, h, std::move(pixels));
+    });
+    std::shared_future<std::shared_ptr<const DecodedTexture>> future = task->get_future().share();
+    if(!fetch_scheduler->submit(JobPriority::High, [task](){ (*task)(); })) {
+        (*task)();
+    }
+    return future;
+}
+
+std::shared_ptr<ImageData> VulkanBot::bind_texture(RenderContext& context, std::shared_ptr<const DecodedTexture> texture) {
+    // the same pixels might already be on the GPU, even if they came from a different URL
+    std::shared_ptr<ImageData> image = texture_cache->findResident(texture->hash);
+    if(image) {
+        context.bindImage(*image);
+    } else {
+        auto t1 = std::chrono::steady_clock::now();
+        image = context.uploadImage(texture->width, texture->height, texture->pixels);
+        stage("texture_upload").observe(secondsSince(t1));
+        texture_cache->storeResident(texture->hash, image, texture->pixels.size());
+    }
+
+    return image;
+}
+
+}
@@ -0,0 +1,116 @@
+#include "texture_cache.h"
+
+#include <openssl/evp.h>
+
+namespace vulkanbot
+{
+	static std::string hashPixels(uint32_t width, uint32_t height, const std::vector<unsigned char>& pixels)
+	{
+		EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+		EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+		EVP_DigestUpdate(ctx, &width, sizeof(width));
+		EVP_DigestUpdate(ctx, &height, sizeof(height));
+		EVP_DigestUpdate(ctx, pixels.data(), pixels.size());
+
+		unsigned char digest[EVP_MAX_MD_SIZE];
+		unsigned int length = 0;
+		EVP_DigestFinal_ex(ctx, digest, &length);
+		EVP_MD_CTX_free(ctx);
+
+		static constexpr char hex[] = "0123456789abcdef";
+		std::string hash;
+		for(unsigned int i=0; i<length; i++)
+		{
+			hash += hex[digest[i] >> 4];
+			hash += hex[digest[i] & 0xf];
+		}
+		return hash;
+	}
+
+	template<typename T>
+	const T* TextureCache::Lru<T>::find(const std::string& key)
+	{
+		auto it = index.find(key);
+		if(it == index.end())
+			return nullptr;
+		entries.splice(entries.begin(), entries, it->second);
+		return &std::get<1>(*it->second);
+	}
+
+	template<typename T>
+	void TextureCache::Lru<T>::insert(const std::string& key, T value, size_t size)
+	{
+		auto it = index.find(key);
+		if(it != index.end())
+		{
+			bytes -= std::get<2>(*it->second);
+			entries.erase(it->second);
+		}
+
+		entries.emplace_front(key, std::move(value), size);
+		index[key] = entries.begin();
+		bytes += size;
+
+		// entries still in use elsewhere stay alive through their shared_ptr, they just are not found anymore
+		while(bytes > maxBytes && entries.size() > 1)
+		{
+			auto& last = entries.back();
+			bytes -= std::get<2>(last);
+			index.erase(std::get<0>(last));
+			entries.pop_back();
+		}
+	}
+
+	TextureCache::TextureCache(size_t maxDecodedBytes, size_t maxResidentBytes)
+	{
+		m_decoded.maxBytes = maxDecodedBytes;
+		m_resident.maxBytes = maxResidentBytes;
+	}
+
+	std::shared_ptr<const DecodedTexture> TextureCache::findDecoded(const std::string& url)
+	{
+		std::unique_lock lock(m_mutex);
+		if(auto texture = m_decoded.find(url))
+		{
+			m_decodedHits++;
+			return *texture;
+		}
+		m_decodedMisses++;
+		return nullptr;
+	}
+
+	std::shared_ptr<const DecodedTexture> TextureCache::storeDecoded(const std::string& url, uint32_t width, uint32_t height, std::vector<unsigned char> pixels)
+	{
+		std::string hash = hashPixels(width, height, pixels);
+		auto texture = std::make_shared<const DecodedTexture>(width, height, std::move(pixels), std::move(hash));
+
+		std::unique_lock lock(m_mutex);
+		m_decoded.insert(url, texture, texture->pixels.size());
+		return texture;
+	}
+
+	std::shared_ptr<ImageData> TextureCache::findResident(const std::string& hash)
+	{
+		std::unique_lock lock(m_mutex);
+		if(auto image = m_resident.find(hash))
+		{
+			m_residentHits++;
+			return *image;
+		}
+		m_residentMisses++;
+		return nullptr;
+	}
+
+	void TextureCache::storeResident(const std::string& hash, std::shared_ptr<ImageData> image, size_t bytes)
+	{
+		std::unique_lock lock(m_mutex);
+		m_resident.insert(hash, std::move(image), bytes);
+	}
+
+	TextureCache::Stats TextureCache::stats() const
+	{
+		std::unique_lock lock(m_mutex);
+		return {m_decodedHits, m_decodedMisses, m_residentHits, m_residentMisses,
+			m_decoded.entries.size(), m_decoded.bytes, m_resident.entries.size(), m_resident.bytes};
+	}
+}
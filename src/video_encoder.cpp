@@ -0,0 +1,365 @@
+#include "video_encoder.h"
+
+#include <cstring>
+
+#include <codec.h>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+}
+
+namespace vulkanbot
+{
+	// Wraps the mapped readback memory into a ref-counted frame, the readback buffer is released once libav drops its last reference.
+	// pal8 frames get a copy of the palette.
+	static av::VideoFrame wrapFrame(std::shared_ptr<uint8_t> data, size_t size, av::PixelFormat pixelFormat, int width, int height,
+		const std::array<uint32_t, 256>* palette)
+	{
+		AVFrame* raw = av_frame_alloc();
+		raw->format = pixelFormat.get();
+		raw->width = width;
+		raw->height = height;
+		raw->buf[0] = av_buffer_create(data.get(), size, [](void* opaque, uint8_t*){
+			delete static_cast<std::shared_ptr<uint8_t>*>(opaque);
+		}, new std::shared_ptr<uint8_t>(data), AV_BUFFER_FLAG_READONLY);
+		av_image_fill_arrays(raw->data, raw->linesize, data.get(), pixelFormat.get(), width, height, VideoEncoder::rowAlignment);
+		if(palette)
+		{
+			// av_image_fill_arrays puts the palette behind the indices, which is where the next frame is
+			raw->buf[1] = av_buffer_alloc(sizeof(*palette));
+			std::memcpy(raw->buf[1]->data, palette->data(), sizeof(*palette));
+			raw->data[1] = raw->buf[1]->data;
+		}
+
+		av::VideoFrame frame(raw);
+		av_frame_free(&raw);
+		return frame;
+	}
+
+	// Growable buffer the muxer writes into, front to back.
+	struct MemoryOutput : public av::CustomIO
+	{
+		std::string data;
+
+		int write(const uint8_t* buffer, size_t size) override
+		{
+			data.append(reinterpret_cast<const char*>(buffer), size);
+			return static_cast<int>(size);
+		}
+		const char* name() const override
+		{
+			return "memory";
+		}
+	};
+
+	// the default WebP encoder only writes still images
+	static av::Codec encodingCodec(const av::OutputFormat& format)
+	{
+		if(std::string(format.name()) == "webp")
+			return av::findEncodingCodec("libwebp_anim");
+		return av::findEncodingCodec(format);
+	}
+
+	VideoEncoder::VideoEncoder(const std::string& path, int width, int height, int fps, long bitrate, unsigned int threads, bool nv12)
+		: m_width(width), m_height(height), m_timebase{1, fps},
+		m_format(std::string(), path), m_encoder{encodingCodec(m_format)}
+	{
+		open(bitrate, threads, nv12);
+		m_context.openOutput(path);
+		writeHeader({});
+		startWorkers();
+	}
+
+	VideoEncoder::VideoEncoder(int width, int height, int fps, long bitrate, const std::string& container, unsigned int threads, bool nv12)
+		: m_width(width), m_height(height), m_timebase{1, fps},
+		m_memory(std::make_unique<MemoryOutput>()), m_format(container), m_encoder{encodingCodec(m_format)}
+	{
+		open(bitrate, threads, nv12);
+		m_context.openOutput(m_memory.get());
+
+		av::Dictionary options;
+		if(m_container == "mp4")
+		{
+			// an empty moov up front and a moof with every keyframe, so nothing has to be rewritten once the length is known
+			options.set("movflags", "frag_keyframe+empty_moov+default_base_moof");
+		}
+		writeHeader(std::move(options));
+		startWorkers();
+	}
+
+	bool VideoEncoder::supports(const std::string& container)
+	{
+		return !encodingCodec(av::OutputFormat(container)).isNull();
+	}
+
+	VideoEncoder::~VideoEncoder()
+	{
+		stop();
+		// closes the output while the memory it writes to is still there
+		m_context.close();
+	}
+
+	void VideoEncoder::open(long bitrate, unsigned int threads, bool nv12)
+	{
+		m_context.setFormat(m_format);
+		m_container = m_format.name();
+		m_bitrate = bitrate;
+		// libwebp only takes planar YUV
+		if(m_container == "gif")
+			m_pixelFormat = av::PixelFormat("pal8");
+		else
+			m_pixelFormat = av::PixelFormat(nv12 && m_container != "webp" ? "nv12" : "yuv420p");
+
+		// The GIF encoder compares every frame with the previous one and libwebp_anim only hands out the whole animation at the end,
+		// neither of them can be cut into segments. B-frames are only for the codecs of the other containers.
+		bool segmented = threads > 1 && m_container != "gif" && m_container != "webp";
+		int maxBFrames = !segmented && m_container != "gif" && m_container != "webp" ? 1 : 0;
+
+		// the segment encoders only set up the stream here, they are all configured the same so their headers match
+		m_encoder = createEncoder(maxBFrames, segmented ? 1 : 0);
+
+		av::Stream stream = m_context.addStream(m_encoder);
+		stream.setFrameRate(m_timebase);
+
+		if(segmented)
+		{
+			// every thread busy with a segment and the next one filling up
+			m_maxBuffered = (threads + 1) * segmentFrames;
+			m_segmentThreads = threads;
+		}
+	}
+
+	void VideoEncoder::startWorkers()
+	{
+		for(unsigned int i=0; i<m_segmentThreads; i++)
+			m_workers.emplace_back(&VideoEncoder::work, this);
+	}
+
+	av::VideoEncoderContext VideoEncoder::createEncoder(int maxBFrames, int threads) const
+	{
+		av::VideoEncoderContext encoder{m_encoder.codec()};
+		encoder.setWidth(m_width);
+		encoder.setHeight(m_height);
+		encoder.setTimeBase(m_timebase);
+		encoder.setBitRate(m_bitrate);
+		encoder.setGopSize(gopSize);
+		encoder.setMaxBFrames(maxBFrames);
+		encoder.setPixelFormat(m_pixelFormat);
+		encoder.raw()->thread_count = threads;
+		// the parameter sets go into the container header instead of the stream, where the segments would repeat them
+		if(m_format.raw()->flags & AVFMT_GLOBALHEADER)
+			encoder.raw()->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+		encoder.open(av::Codec{});
+		return encoder;
+	}
+
+	void VideoEncoder::setPalette(const std::array<uint32_t, 256>& palette)
+	{
+		m_palette = palette;
+	}
+
+	void VideoEncoder::writeHeader(av::Dictionary options)
+	{
+		// the WebP muxer plays the animation only once by default
+		if(m_container == "gif" || m_container == "webp")
+			options.set("loop", "0");
+		m_context.dump();
+		m_context.writeHeader(options);
+		m_context.flush();
+	}
+
+	void VideoEncoder::encode(int frame, std::shared_ptr<uint8_t> data, size_t size)
+	{
+		av::VideoFrame videoFrame = wrapFrame(std::move(data), size, m_pixelFormat, m_width, m_height,
+			m_container == "gif" ? &m_palette : nullptr);
+		videoFrame.setTimeBase(m_timebase);
+		videoFrame.setStreamIndex(0);
+		videoFrame.setPictureType();
+		videoFrame.setPts(av::Timestamp(frame, m_timebase));
+
+		if(m_workers.empty())
+		{
+			// the packet might belong to an earlier frame the encoder held back, it carries that frame's pts already
+			av::Packet packet = m_encoder.encode(videoFrame);
+			write(packet);
+			return;
+		}
+
+		std::unique_lock lock(m_mutex);
+		m_condition.wait(lock, [this]{ return m_buffered < m_maxBuffered || m_error; });
+		if(m_error)
+			std::rethrow_exception(m_error);
+
+		int index = frame / segmentFrames;
+		// frames come in order, so the segments before this one are complete
+		for(auto& [i, segment] : m_segments)
+		{
+			if(i < index)
+				segment.closed = true;
+		}
+		m_segments[index].frames.push_back(std::move(videoFrame));
+		m_buffered++;
+		m_condition.notify_all();
+
+		writeSegments(lock);
+	}
+
+	void VideoEncoder::finish()
+	{
+		if(m_workers.empty())
+		{
+			// the encoder holds back frames for B-frames and lookahead, drain them before closing the file
+			while(true)
+			{
+				av::Packet packet = m_encoder.encode();
+				if(!packet)
+					break;
+				write(packet);
+			}
+			m_context.writeTrailer();
+			return;
+		}
+
+		{
+			std::unique_lock lock(m_mutex);
+			for(auto& [i, segment] : m_segments)
+				segment.closed = true;
+			m_condition.notify_all();
+
+			while(!m_segments.empty())
+			{
+				m_condition.wait(lock, [this]{ return m_segments.begin()->second.done || m_error; });
+				if(m_error)
+					std::rethrow_exception(m_error);
+				writeSegments(lock);
+			}
+		}
+		stop();
+		m_context.writeTrailer();
+	}
+
+	std::string VideoEncoder::takeData()
+	{
+		if(!m_memory)
+			return {};
+		return std::move(m_memory->data);
+	}
+
+	void VideoEncoder::write(av::Packet& packet)
+	{
+		if(packet)
+		{
+			packet.setStreamIndex(0);
+			m_context.writePacket(packet);
+		}
+	}
+
+	void VideoEncoder::work()
+	{
+		std::unique_lock lock(m_mutex);
+		while(true)
+		{
+			Segment* segment = nullptr;
+			m_condition.wait(lock, [this, &segment]{
+				segment = nextSegment();
+				return m_stop || segment;
+			});
+			if(m_stop)
+				return;
+
+			segment->busy = true;
+			std::deque<av::VideoFrame> frames = std::move(segment->frames);
+			segment->frames.clear();
+			bool flush = segment->closed;
+			lock.unlock();
+
+			std::vector<av::Packet> packets;
+			try
+			{
+				// the segment map is only erased from once the segment is done, so the pointer stays valid without the lock
+				if(!segment->encoder)
+					segment->encoder = createEncoder(0, 1);
+				for(av::VideoFrame& frame : frames)
+				{
+					av::Packet packet = segment->encoder->encode(frame);
+					if(packet)
+						packets.push_back(std::move(packet));
+				}
+				while(flush)
+				{
+					av::Packet packet = segment->encoder->encode();
+					if(!packet)
+						break;
+					packets.push_back(std::move(packet));
+				}
+			}
+			catch(...)
+			{
+				lock.lock();
+				if(!m_error)
+					m_error = std::current_exception();
+				m_condition.notify_all();
+				continue;
+			}
+
+			// hands the readback buffers back before taking the lock
+			size_t encoded = frames.size();
+			frames.clear();
+
+			lock.lock();
+			m_buffered -= encoded;
+			segment->packets.insert(segment->packets.end(), std::make_move_iterator(packets.begin()), std::make_move_iterator(packets.end()));
+			segment->busy = false;
+			if(flush)
+			{
+				segment->encoder.reset();
+				segment->done = true;
+			}
+			m_condition.notify_all();
+		}
+	}
+
+	VideoEncoder::Segment* VideoEncoder::nextSegment()
+	{
+		if(m_error)
+			return nullptr;
+		// the oldest segment first, it is the one holding up the muxer
+		for(auto& [i, segment] : m_segments)
+		{
+			if(!segment.busy && !segment.done && (!segment.frames.empty() || segment.closed))
+				return &segment;
+		}
+		return nullptr;
+	}
+
+	void VideoEncoder::writeSegments(std::unique_lock<std::mutex>& lock)
+	{
+		// the map is ordered by the first frame, so the front is always the next one to go out
+		while(!m_segments.empty() && m_segments.begin()->second.done)
+		{
+			std::vector<av::Packet> packets = std::move(m_segments.begin()->second.packets);
+			m_segments.erase(m_segments.begin());
+
+			lock.unlock();
+			for(av::Packet& packet : packets)
+				write(packet);
+			lock.lock();
+		}
+	}
+
+	void VideoEncoder::stop()
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_all();
+		for(std::thread& worker : m_workers)
+		{
+			if(worker.joinable())
+				worker.join();
+		}
+	}
+}
@@ -2,10 +2,12 @@
 
 #include <bits/stdint-uintn.h>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <glm/fwd.hpp>
 #include <iostream>
 #include <fstream>
+#include <optional>
 #include <stdexcept>
 #include <chrono>
 #include <string>
@@ -13,27 +15,74 @@
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
 
-#include "LimitedIncluder.h"
 
 namespace vulkanbot
 {
-	uint32_t findMemoryType(vk::PhysicalDeviceMemoryProperties const & memoryProperties, int32_t typeBits, vk::MemoryPropertyFlags requirementsMask)
+	// push constants of yuv420p_encode.comp and palette_encode.comp, offsets in bytes from the start of the output buffer
+	struct EncodeParameters {
+		uint32_t width;
+		uint32_t height;
+		uint32_t offset;
+		uint32_t stride;
+		std::array<uint32_t, 2> chromaOffset;
+		uint32_t chromaStride;
+		uint32_t nv12;
+	};
+	// local_size of both conversion shaders in both dimensions
+	constexpr uint32_t encodeGroupSize = 8;
+	// levels of red, green and blue in the palette, palette_encode.comp has the same
+	constexpr std::array<uint32_t, 3> paletteLevels = {6, 7, 6};
+
+	FrameLayout frameLayout(FrameFormat format, uint32_t width, uint32_t height)
 	{
-		uint32_t typeIndex = uint32_t( ~0 );
-		for ( uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++ )
+		auto align = [](uint32_t n){ return (n + frameRowAlignment - 1) / frameRowAlignment * frameRowAlignment; };
+		uint32_t chromaWidth = (width + 1) / 2;
+		uint32_t chromaHeight = (height + 1) / 2;
+
+		FrameLayout layout{};
+		switch(format)
 		{
-			if((typeBits & 1) && ((memoryProperties.memoryTypes[i].propertyFlags & requirementsMask) == requirementsMask))
-			{
-				typeIndex = i;
+			case FrameFormat::RGBA:
+				layout.stride = width * 4;
+				break;
+			case FrameFormat::PAL8:
+				layout.stride = align(width);
+				break;
+			case FrameFormat::YUV420P:
+				layout.stride = align(width);
+				layout.chromaStride = align(chromaWidth);
 				break;
+			case FrameFormat::NV12:
+				layout.stride = align(width);
+				// both samples of a chroma pixel next to each other
+				layout.chromaStride = align(chromaWidth * 2);
+				break;
+		}
+		layout.chromaOffset[0] = layout.stride * height;
+		layout.chromaOffset[1] = format == FrameFormat::YUV420P ? layout.chromaOffset[0] + layout.chromaStride * chromaHeight : layout.chromaOffset[0];
+		layout.size = layout.chromaOffset[1] + static_cast<vk::DeviceSize>(layout.chromaStride) * chromaHeight;
+		return layout;
+	}
+
+	std::array<uint32_t, 256> paletteColors()
+	{
+		std::array<uint32_t, 256> palette{};
+		auto [reds, greens, blues] = paletteLevels;
+		for(uint32_t r=0; r<reds; r++)
+		{
+			for(uint32_t g=0; g<greens; g++)
+			{
+				for(uint32_t b=0; b<blues; b++)
+				{
+					palette[(r*greens + g)*blues + b] = 0xff000000u
+						| (r*255/(reds-1)) << 16 | (g*255/(greens-1)) << 8 | (b*255/(blues-1));
+				}
 			}
-			typeBits >>= 1;
 		}
-		assert( typeIndex != uint32_t( ~0 ) );
-		return typeIndex;
+		return palette;
 	}
 
-	ImageData::ImageData(	vk::PhysicalDevice const & physicalDevice,
+	ImageData::ImageData(	DeviceAllocator & allocator,
 							vk::UniqueDevice const & device,
 							vk::Format format_,
 							vk::Extent2D const & extent,
@@ -49,14 +98,8 @@ namespace vulkanbot
 			vk::SharingMode::eExclusive, 0, nullptr,
 			vk::ImageLayout::eUndefined));
 
-		vk::MemoryRequirements memoryRequirements = device->getImageMemoryRequirements(image.get());
-
-		uint32_t memoryTypeIndex = findMemoryType(physicalDevice.getMemoryProperties(),
-			memoryRequirements.memoryTypeBits, memoryProperties);
-
-		deviceMemory = device->allocateMemoryUnique(vk::MemoryAllocateInfo(memoryRequirements.size, memoryTypeIndex));
-
-		device->bindImageMemory(image.get(), deviceMemory.get(), 0);
+		allocation = allocator.allocate(image.get(), memoryProperties);
+		size = allocation.size();
 
 		vk::ComponentMapping componentMapping(vk::ComponentSwizzle::eIdentity,
 			vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity);
@@ -69,39 +112,27 @@ namespace vulkanbot
 		imageView = device->createImageViewUnique(imageViewCreateInfo);
 	}
 
-	Mesh::Mesh(	vk::PhysicalDevice const & physicalDevice,
+	Mesh::Mesh(	DeviceAllocator & allocator,
 				vk::UniqueDevice const & device,
 				int const vertexCount, int const indexCount)
 	{
 		this->vertexCount = vertexCount;
 		this->indexCount = indexCount;
 
+		// meshes stay for as long as the backend, linear blocks are all they need
 		vertexBuffer = device->createBufferUnique(vk::BufferCreateInfo({}, vertexCount * sizeof(glm::vec3),
 			vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst));
-		vk::MemoryRequirements vertexMemoryRequirements = device->getBufferMemoryRequirements(vertexBuffer.get());
+		vertexMemory = allocator.allocate(vertexBuffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal, {}, AllocationStrategy::Linear);
 		texCoordBuffer = device->createBufferUnique(vk::BufferCreateInfo({}, vertexCount * sizeof(glm::vec2),
 			vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst));
-		vk::MemoryRequirements texCoordMemoryRequirements = device->getBufferMemoryRequirements(texCoordBuffer.get());
+		texCoordMemory = allocator.allocate(texCoordBuffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal, {}, AllocationStrategy::Linear);
 		normalBuffer = device->createBufferUnique(vk::BufferCreateInfo({}, vertexCount * sizeof(glm::vec3),
 			vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst));
-		vk::MemoryRequirements normalMemoryRequirements = device->getBufferMemoryRequirements(normalBuffer.get());
-
-		vk::DeviceSize totalSize = vertexMemoryRequirements.size + texCoordMemoryRequirements.size + normalMemoryRequirements.size;
-		uint32_t typeBits = vertexMemoryRequirements.memoryTypeBits | texCoordMemoryRequirements.memoryTypeBits | normalMemoryRequirements.memoryTypeBits;
-		uint32_t memoryTypeIndex = findMemoryType(physicalDevice.getMemoryProperties(), typeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		memory = device->allocateMemoryUnique(vk::MemoryAllocateInfo(totalSize, memoryTypeIndex));
-
-		device->bindBufferMemory(vertexBuffer.get(), 	memory.get(), 0);
-		device->bindBufferMemory(texCoordBuffer.get(), 	memory.get(), vertexMemoryRequirements.size);
-		device->bindBufferMemory(normalBuffer.get(), 	memory.get(), vertexMemoryRequirements.size + texCoordMemoryRequirements.size);
+		normalMemory = allocator.allocate(normalBuffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal, {}, AllocationStrategy::Linear);
 
 		indexBuffer = device->createBufferUnique(vk::BufferCreateInfo({}, indexCount * sizeof(glm::vec3),
 			vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst));
-		vk::MemoryRequirements indexMemoryRequirements = device->getBufferMemoryRequirements(indexBuffer.get());
-		uint32_t indexMemoryTypeIndex = findMemoryType(physicalDevice.getMemoryProperties(), indexMemoryRequirements.memoryTypeBits,
-			vk::MemoryPropertyFlagBits::eDeviceLocal);
-		indexMemory = device->allocateMemoryUnique(vk::MemoryAllocateInfo(indexMemoryRequirements.size, indexMemoryTypeIndex));
-		device->bindBufferMemory(indexBuffer.get(), indexMemory.get(), 0);
+		indexMemory = allocator.allocate(indexBuffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal, {}, AllocationStrategy::Linear);
 	}
 
 	void generate_grid(int N, std::vector<glm::vec3> &vertices, std::vector<glm::vec2> &texCoords, std::vector<uint16_t> &indices)
@@ -138,6 +169,178 @@ namespace vulkanbot
 		}
 	}
 
+	static std::vector<char> readFile(const std::filesystem::path& filename)
+	{
+		std::ifstream file(filename, std::ios::ate | std::ios::binary);
+
+		if(!file.is_open())
+		{
+			throw std::runtime_error("failed to open file!");
+		}
+
+		size_t fileSize = (size_t) file.tellg();
+		std::vector<char> buffer(fileSize);
+		file.seekg(0);
+		file.read(buffer.data(), fileSize);
+
+		file.close();
+		return buffer;
+	}
+
+	// Our own header in front of the driver's pipeline cache data, so a cache from another device or driver is never handed to it.
+	struct PipelineCacheFileHeader {
+		uint32_t magic;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+	};
+	static constexpr uint32_t pipelineCacheMagic = 0x56425043; // "VBPC"
+
+	void VulkanBackend::configurePipelineCache(std::optional<std::filesystem::path> path, size_t maxBytes, std::chrono::seconds saveInterval)
+	{
+		m_pipelineCachePath = path;
+		m_pipelineCacheMaxBytes = maxBytes;
+		m_pipelineCacheSaveInterval = saveInterval;
+	}
+
+	void VulkanBackend::loadPipelineCache()
+	{
+		vk::PhysicalDeviceProperties properties = m_physicalDevice.getProperties();
+		std::vector<char> data;
+
+		if(m_pipelineCachePath && std::filesystem::exists(*m_pipelineCachePath))
+		{
+			try
+			{
+				std::vector<char> file = readFile(*m_pipelineCachePath);
+
+				PipelineCacheFileHeader header{};
+				if(file.size() >= sizeof(header))
+					memcpy(&header, file.data(), sizeof(header));
+
+				vk::PipelineCacheHeaderVersionOne driverHeader{};
+				if(file.size() >= sizeof(header) + sizeof(driverHeader))
+					memcpy(&driverHeader, file.data() + sizeof(header), sizeof(driverHeader));
+
+				if(header.magic == pipelineCacheMagic &&
+					header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+					header.driverVersion == properties.driverVersion &&
+					memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0 &&
+					header.dataSize == file.size() - sizeof(header) &&
+					driverHeader.headerVersion == vk::PipelineCacheHeaderVersion::eOne &&
+					driverHeader.vendorID == properties.vendorID && driverHeader.deviceID == properties.deviceID &&
+					memcmp(driverHeader.pipelineCacheUUID.data(), properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0)
+				{
+					data.assign(file.begin() + sizeof(header), file.end());
+				}
+				else
+				{
+					std::cout << "Ignoring pipeline cache " << *m_pipelineCachePath << " from a different device or driver" << std::endl;
+				}
+			}
+			catch(const std::runtime_error& err)
+			{
+				std::cerr << "Cannot read pipeline cache " << *m_pipelineCachePath << ": " << err.what() << std::endl;
+			}
+		}
+
+		m_pipelineCache = m_device->createPipelineCacheUnique(vk::PipelineCacheCreateInfo({}, data.size(), data.data()));
+		m_pipelineCacheStats.loadedBytes = data.size();
+		std::cout << "Loaded " << data.size() << " bytes of pipeline cache" << std::endl;
+
+		if(m_pipelineCachePath && m_pipelineCacheSaveInterval.count() > 0)
+			m_pipelineCacheSaverThread = std::thread(&VulkanBackend::pipelineCacheSaver, this);
+	}
+
+	void VulkanBackend::pipelineCacheSaver()
+	{
+		std::unique_lock lock(m_pipelineCacheSaverMutex);
+		while(!m_pipelineCacheSaverWake.wait_for(lock, m_pipelineCacheSaveInterval, [this](){ return m_pipelineCacheSaverStop; }))
+		{
+			bool unsaved;
+			{
+				std::shared_lock cacheLock(m_pipelineCacheMutex);
+				unsaved = m_pipelinesUnsaved > 0;
+			}
+			if(unsaved)
+			{
+				lock.unlock();
+				savePipelineCache();
+				lock.lock();
+			}
+		}
+	}
+
+	void VulkanBackend::savePipelineCache()
+	{
+		// one save at a time, they all go through the same temporary file
+		std::unique_lock writeLock(m_pipelineCacheWriteMutex);
+		std::vector<uint8_t> data;
+		{
+			// only the copy of the data holds up pipeline creation, not the disk
+			std::unique_lock lock(m_pipelineCacheMutex);
+			if(!m_pipelineCache || !m_pipelineCachePath)
+				return;
+
+			data = m_device->getPipelineCacheData(m_pipelineCache.get());
+			m_pipelinesUnsaved = 0;
+			if(data.size() > m_pipelineCacheMaxBytes)
+			{
+				// start over instead of letting the cache (and the file) grow without bound
+				std::cout << "Pipeline cache exceeded " << m_pipelineCacheMaxBytes << " bytes, resetting it" << std::endl;
+				m_pipelineCache = m_device->createPipelineCacheUnique(vk::PipelineCacheCreateInfo());
+				m_pipelineCacheStats.resets++;
+				return;
+			}
+		}
+
+		vk::PhysicalDeviceProperties properties = m_physicalDevice.getProperties();
+		PipelineCacheFileHeader header{pipelineCacheMagic, properties.vendorID, properties.deviceID, properties.driverVersion, {}, data.size()};
+		memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+
+		std::error_code ec;
+		if(m_pipelineCachePath->has_parent_path())
+			std::filesystem::create_directories(m_pipelineCachePath->parent_path(), ec);
+
+		std::filesystem::path temp = *m_pipelineCachePath;
+		temp += ".tmp";
+		{
+			std::ofstream file(temp, std::ios::binary);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(data.data()), data.size());
+			if(!file)
+			{
+				std::cerr << "Cannot write pipeline cache " << temp << std::endl;
+				return;
+			}
+		}
+		std::filesystem::rename(temp, *m_pipelineCachePath, ec);
+		if(ec)
+		{
+			std::cerr << "Cannot write pipeline cache " << *m_pipelineCachePath << ": " << ec.message() << std::endl;
+			return;
+		}
+
+		std::unique_lock lock(m_pipelineCacheMutex);
+		m_pipelineCacheStats.savedBytes = data.size();
+		m_pipelineCacheStats.saves++;
+	}
+
+	void VulkanBackend::pipelineCreated()
+	{
+		std::unique_lock lock(m_pipelineCacheMutex);
+		m_pipelineCacheStats.pipelinesCreated++;
+		m_pipelinesUnsaved++;
+	}
+
+	PipelineCacheStats VulkanBackend::pipelineCacheStats() const
+	{
+		std::unique_lock lock(m_pipelineCacheMutex);
+		return m_pipelineCacheStats;
+	}
+
 	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 		VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -151,7 +354,7 @@ namespace vulkanbot
 		return VK_FALSE;
 	}
 
-	void VulkanBackend::initVulkan(int width, int height,
+	void VulkanBackend::initVulkan(int width, int height, int contexts, int framesInFlight, int batchSize,
 		const std::filesystem::path& shadersPath, const std::filesystem::path& shaderIncludePath,
 		bool validation, int debugSeverity, int debugType)
 	{
@@ -159,6 +362,7 @@ namespace vulkanbot
 		m_height = static_cast<uint32_t>(height);
 		m_shadersPath = shadersPath;
 		m_shaderIncludePath = shaderIncludePath;
+		m_compiler = std::make_unique<ShaderCompiler>(m_shaderIncludePath, std::move(m_shaderCache), m_compilerThreads);
 
 		vk::ApplicationInfo applicationInfo("VulkanBot", 1, "VulkanBot", 1, VK_API_VERSION_1_1);
 
@@ -191,68 +395,69 @@ namespace vulkanbot
 					return qfp.queueFlags & vk::QueueFlagBits::eGraphics;
 		}));
 		assert(graphicsQueueFamilyIndex < queueFamilyProperties.size());
-		size_t transferQueueFamilyIndex = std::distance(
-			queueFamilyProperties.begin(),
-			std::find_if(
-				queueFamilyProperties.begin(), queueFamilyProperties.end(), []( vk::QueueFamilyProperties const & qfp ) {
-					return qfp.queueFlags & vk::QueueFlagBits::eTransfer;
-		}));
-		assert(transferQueueFamilyIndex < queueFamilyProperties.size());
+		m_graphicsQueueFamilyIndex = static_cast<uint32_t>(graphicsQueueFamilyIndex);
+
+		// A family that can only transfer is usually a DMA engine that works independently of the graphics queue,
+		// otherwise take any other family that can transfer, or share the graphics queue if there is none.
+		auto findTransferFamily = [&](vk::QueueFlags excluded) {
+			for(size_t i=0; i<queueFamilyProperties.size(); i++)
+			{
+				vk::QueueFlags flags = queueFamilyProperties[i].queueFlags;
+				if(i != graphicsQueueFamilyIndex && (flags & vk::QueueFlagBits::eTransfer) && !(flags & excluded))
+					return i;
+			}
+			return graphicsQueueFamilyIndex;
+		};
+		size_t transferQueueFamilyIndex = findTransferFamily(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute);
+		if(transferQueueFamilyIndex == graphicsQueueFamilyIndex)
+			transferQueueFamilyIndex = findTransferFamily(vk::QueueFlagBits::eGraphics);
+		m_transferQueueFamilyIndex = static_cast<uint32_t>(transferQueueFamilyIndex);
+		m_dedicatedTransfer = m_transferQueueFamilyIndex != m_graphicsQueueFamilyIndex;
+
+		uint32_t timestampBits = queueFamilyProperties[graphicsQueueFamilyIndex].timestampValidBits;
+		m_timestampMask = timestampBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << timestampBits) - 1;
+		m_timestampPeriod = m_physicalDevice.getProperties().limits.timestampPeriod;
+		if(!m_timestampMask)
+			std::cout << "The graphics queue does not support timestamps, GPU timings are not available" << std::endl;
 
 		float queuePriority = 0.0f;
-		vk::DeviceQueueCreateInfo deviceQueueCreateInfo(
-			vk::DeviceQueueCreateFlags(), static_cast<uint32_t>(graphicsQueueFamilyIndex), 1, &queuePriority);
-		m_device = m_physicalDevice.createDeviceUnique(vk::DeviceCreateInfo(vk::DeviceCreateFlags(), deviceQueueCreateInfo, layers));
+		std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos = {
+			vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), m_graphicsQueueFamilyIndex, 1, &queuePriority)
+		};
+		if(m_dedicatedTransfer)
+			deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), m_transferQueueFamilyIndex, 1, &queuePriority));
+		m_device = m_physicalDevice.createDeviceUnique(vk::DeviceCreateInfo(vk::DeviceCreateFlags(), deviceQueueCreateInfos, layers));
 
-		m_commandPool = m_device->createCommandPoolUnique(
-			vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, graphicsQueueFamilyIndex));
+		loadPipelineCache();
 
-		m_queue = m_device->getQueue(graphicsQueueFamilyIndex, 0);
-		m_transferQueue = m_device->getQueue(transferQueueFamilyIndex, 0);
+		m_allocator = std::make_unique<DeviceAllocator>(m_physicalDevice, m_device.get());
+		m_staging = std::make_unique<StagingRing>(*m_allocator, m_physicalDevice, m_device.get(), m_stagingSize);
 
-		m_fence = m_device->createFenceUnique(vk::FenceCreateInfo());
-		m_transferFence = m_device->createFenceUnique(vk::FenceCreateInfo());
+		m_commandPool = m_device->createCommandPoolUnique(
+			vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_graphicsQueueFamilyIndex));
+		m_transferCommandPool = m_device->createCommandPoolUnique(
+			vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_transferQueueFamilyIndex));
+
+		m_queue = m_device->getQueue(m_graphicsQueueFamilyIndex, 0);
+		m_transferQueue = m_device->getQueue(m_transferQueueFamilyIndex, 0);
+		if(m_dedicatedTransfer)
+			std::cout << "Using queue family " << m_transferQueueFamilyIndex << " for transfers" << std::endl;
+		else
+			std::cout << "No dedicated transfer queue, transferring on the graphics queue" << std::endl;
+
+		m_uploadCommandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+			m_transferCommandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
+		if(m_dedicatedTransfer)
+		{
+			m_uploadAcquireCommandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+				m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
+		}
+		m_uploadSemaphore = m_device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
 
 		m_sampler = m_device->createSamplerUnique(vk::SamplerCreateInfo({}, vk::Filter::eLinear, vk::Filter::eLinear,
 			vk::SamplerMipmapMode::eLinear, vk::SamplerAddressMode::eRepeat, vk::SamplerAddressMode::eRepeat, vk::SamplerAddressMode::eRepeat,
 			0.0f, false, 16.0f, false, vk::CompareOp::eNever, 0.0f, 0.0f, vk::BorderColor::eFloatOpaqueBlack));
 
-		m_renderImage = new ImageData(m_physicalDevice, m_device, vk::Format::eR8G8B8A8Unorm,
-			{m_width, m_height},
-			vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eStorage,
-			vk::MemoryPropertyFlagBits::eDeviceLocal);
-		m_depthImage = new ImageData(m_physicalDevice, m_device, vk::Format::eD32Sfloat,
-			{m_width, m_height},
-			vk::ImageUsageFlagBits::eDepthStencilAttachment,
-			vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eDepth);
-
-		m_encodedImageY = std::make_unique<ImageData>(m_physicalDevice, m_device, vk::Format::eR8Unorm,
-			vk::Extent2D{m_width, m_height},
-			vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eDeviceLocal);
-		m_encodedImageCr = std::make_unique<ImageData>(m_physicalDevice, m_device, vk::Format::eR8Unorm,
-			vk::Extent2D{m_width/2, m_height/2},
-			vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eDeviceLocal);
-		m_encodedImageCb = std::make_unique<ImageData>(m_physicalDevice, m_device, vk::Format::eR8Unorm,
-			vk::Extent2D{m_width/2, m_height/2},
-			vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-		{
-			m_outputImageBuffer = m_device->createBufferUnique(vk::BufferCreateInfo(vk::BufferCreateFlags(), m_width*m_height*4,
-				vk::BufferUsageFlagBits::eTransferDst));
-			m_outputImageMemoryRequirements = m_device->getBufferMemoryRequirements(m_outputImageBuffer.get());
-			std::cout << "Output Buffer memory: " << m_outputImageMemoryRequirements.size << std::endl;
-
-			uint32_t memoryTypeIndex = findMemoryType(m_physicalDevice.getMemoryProperties(),
-				m_outputImageMemoryRequirements.memoryTypeBits,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-			m_outputImageMemory = m_device->allocateMemoryUnique(vk::MemoryAllocateInfo(m_outputImageMemoryRequirements.size, memoryTypeIndex));
-
-			m_device->bindBufferMemory(m_outputImageBuffer.get(), m_outputImageMemory.get(), 0);
-		}
-
 		std::vector<glm::vec3> vertices;
 		std::vector<glm::vec2> texCoords;
 		std::vector<glm::vec3> normals;
@@ -292,35 +497,15 @@ namespace vulkanbot
 			m_device->unmapMemory(m_vertexMemory.get());
 		}
 		*/
-		{
-			m_uniformBuffer = m_device->createBufferUnique(vk::BufferCreateInfo({}, sizeof(UniformBufferObject),
-				vk::BufferUsageFlagBits::eUniformBuffer));
-			vk::MemoryRequirements memoryRequirements = m_device->getBufferMemoryRequirements(m_uniformBuffer.get());
-			uint32_t memoryTypeIndex = findMemoryType(m_physicalDevice.getMemoryProperties(),
-				memoryRequirements.memoryTypeBits,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-			m_uniformMemory = m_device->allocateMemoryUnique(vk::MemoryAllocateInfo(memoryRequirements.size, memoryTypeIndex));
-			m_device->bindBufferMemory(m_uniformBuffer.get(), m_uniformMemory.get(), 0);
-		}
-		{
-			m_outputStorageBuffer = m_device->createBufferUnique(vk::BufferCreateInfo({}, sizeof(OutputStorageObject),
-				vk::BufferUsageFlagBits::eStorageBuffer));
-			vk::MemoryRequirements memoryRequirements = m_device->getBufferMemoryRequirements(m_outputStorageBuffer.get());
-			uint32_t memoryTypeIndex = findMemoryType(m_physicalDevice.getMemoryProperties(),
-				memoryRequirements.memoryTypeBits,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-			m_outputStorageMemory = m_device->allocateMemoryUnique(vk::MemoryAllocateInfo(memoryRequirements.size, memoryTypeIndex));
-			m_device->bindBufferMemory(m_outputStorageBuffer.get(), m_outputStorageMemory.get(), 0);
-		}
 
 		std::array<vk::AttachmentDescription, 2> attachmentDescriptions;
 		attachmentDescriptions[0] = vk::AttachmentDescription(
-			{}, m_renderImage->format, vk::SampleCountFlagBits::e1,
+			{}, vk::Format::eR8G8B8A8Unorm, vk::SampleCountFlagBits::e1,
 			vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
 			vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
 			vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal);
 		attachmentDescriptions[1] = vk::AttachmentDescription(
-			{}, m_depthImage->format, vk::SampleCountFlagBits::e1,
+			{}, vk::Format::eD32Sfloat, vk::SampleCountFlagBits::e1,
 			vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
 			vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
 			vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal);
@@ -341,18 +526,11 @@ namespace vulkanbot
 		m_renderPass = m_device->createRenderPassUnique(
 			vk::RenderPassCreateInfo(vk::RenderPassCreateFlags(), attachmentDescriptions, subpass, dependencies));
 
-		std::array<vk::ImageView, 2> attachments = {
-			m_renderImage->imageView.get(),
-			m_depthImage->imageView.get()
-		};
-		m_framebuffer = m_device->createFramebufferUnique(
-			vk::FramebufferCreateInfo({}, m_renderPass.get(), attachments, m_width, m_height, 1));
-
 		std::array<vk::DescriptorSetLayoutBinding, 2> bindings;
 		bindings[0] = vk::DescriptorSetLayoutBinding(
 			0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute);
 		bindings[1] = vk::DescriptorSetLayoutBinding(
-			1, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute);
+			1, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute);
 		m_descriptorSetLayout = m_device->createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, bindings));
 
 		std::array<vk::DescriptorSetLayoutBinding, 1> computeBindings = {
@@ -360,77 +538,127 @@ namespace vulkanbot
 		};
 		m_computeDescriptorSetLayout = m_device->createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, computeBindings));
 
-		std::array<vk::DescriptorSetLayoutBinding, 4> encodeBindings = {
+		std::array<vk::DescriptorSetLayoutBinding, 2> encodeBindings = {
 			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
-			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
-			vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
-			vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute)
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute)
 		};
 		m_descriptorSetLayoutEncode = m_device->createDescriptorSetLayoutUnique(vk::DescriptorSetLayoutCreateInfo({}, encodeBindings));
 
+		m_pipelineLayout = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, m_descriptorSetLayout.get()));
+		vk::PushConstantRange encodePushConstants(vk::ShaderStageFlagBits::eCompute, 0, sizeof(EncodeParameters));
+		m_pipelineLayoutEncode = m_device->createPipelineLayoutUnique(
+			vk::PipelineLayoutCreateInfo({}, m_descriptorSetLayoutEncode.get(), encodePushConstants));
+
+		std::array<vk::DescriptorSetLayout, 2> computeLayouts = {m_descriptorSetLayout.get(), m_computeDescriptorSetLayout.get()};
+		m_computePipelineLayout = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, computeLayouts));
+
+		m_encodePipeline = createEncodePipeline("yuv420p_encode");
+		m_palettePipeline = createEncodePipeline("palette_encode");
+
+		for(int i=0; i<std::max(contexts, 1); i++)
+		{
+			m_contexts.push_back(std::make_unique<RenderContext>(*this, i, framesInFlight, batchSize));
+			m_idleContexts.push_back(m_contexts.back().get());
+		}
+		std::cout << "Created " << m_contexts.size() << " render contexts" << std::endl;
+	}
+
+	RenderContext::RenderContext(VulkanBackend& backend, int index, int framesInFlight, int batchSize)
+		: m_backend(backend), m_device(backend.m_device), m_physicalDevice(backend.m_physicalDevice), m_index(index),
+		m_width(backend.m_width), m_height(backend.m_height)
+	{
+		m_commandPool = m_device->createCommandPoolUnique(
+			vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_backend.m_graphicsQueueFamilyIndex));
+		m_transferCommandPool = m_device->createCommandPoolUnique(
+			vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_backend.m_transferQueueFamilyIndex));
+
+		m_fence = m_device->createFenceUnique(vk::FenceCreateInfo());
+		m_uploadSemaphore = m_device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+
+		m_layout = frameLayout(m_format, m_width, m_height);
+		m_frames.resize(std::max(framesInFlight, 1));
+		m_batchSize = std::max(batchSize, 1);
+		for(FrameSlot& slot : m_frames)
+		{
+			slot.fence = m_device->createFenceUnique(vk::FenceCreateInfo());
+			if(m_backend.m_dedicatedTransfer)
+			{
+				// frames are copied into device memory first, moving them to the host is left to the transfer queue
+				slot.rendered = m_device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+			}
+		}
+
+		{
+			// one uniform object for every frame that can be in flight, selected with a dynamic offset
+			vk::DeviceSize alignment = m_physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment;
+			m_uniformStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+			m_uniformBuffer = m_device->createBufferUnique(vk::BufferCreateInfo({}, m_uniformStride * m_frames.size() * m_batchSize,
+				vk::BufferUsageFlagBits::eUniformBuffer));
+			m_uniformMemory = m_backend.m_allocator->allocate(m_uniformBuffer.get(),
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, {}, AllocationStrategy::Linear);
+		}
+		if(m_backend.m_timestampMask)
+		{
+			uint32_t queries = m_frames.size() * m_batchSize * timestampsPerFrame + 2;
+			m_queryPool = m_device->createQueryPoolUnique(vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, queries));
+		}
+		{
+			m_outputStorageBuffer = m_device->createBufferUnique(vk::BufferCreateInfo({}, sizeof(OutputStorageObject),
+				vk::BufferUsageFlagBits::eStorageBuffer));
+			m_outputStorageMemory = m_backend.m_allocator->allocate(m_outputStorageBuffer.get(),
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, {}, AllocationStrategy::Linear);
+		}
+
 		vk::DescriptorPoolSize poolSize(vk::DescriptorType::eCombinedImageSampler, 1);
-		vk::DescriptorPoolSize uniformPoolSize(vk::DescriptorType::eUniformBuffer, 1);
-		vk::DescriptorPoolSize storagePoolSize(vk::DescriptorType::eStorageBuffer, 1);
-		vk::DescriptorPoolSize encodePoolSize(vk::DescriptorType::eStorageImage, 4);
+		vk::DescriptorPoolSize uniformPoolSize(vk::DescriptorType::eUniformBufferDynamic, 1);
+		// one encode set per frame slot, with the render image and the output buffer
+		uint32_t encodeSets = static_cast<uint32_t>(m_frames.size());
+		vk::DescriptorPoolSize storagePoolSize(vk::DescriptorType::eStorageBuffer, 1 + encodeSets);
+		vk::DescriptorPoolSize encodePoolSize(vk::DescriptorType::eStorageImage, encodeSets);
 		std::array<vk::DescriptorPoolSize, 4> poolSizes{poolSize, uniformPoolSize, storagePoolSize, encodePoolSize};
 
 		m_descriptorPool = m_device->createDescriptorPoolUnique(
-			vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 3, poolSizes));
+			vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 2 + encodeSets, poolSizes));
 
 		m_descriptorSet = std::move(
-			m_device->allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), m_descriptorSetLayout.get())).front());
+			m_device->allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), m_backend.m_descriptorSetLayout.get())).front());
 		m_computeDescriptorSet = std::move(
-			m_device->allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), m_computeDescriptorSetLayout.get())).front());
-		m_descriptorSetEncode = std::move(
-			m_device->allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), m_descriptorSetLayoutEncode.get())).front());
+			m_device->allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), m_backend.m_computeDescriptorSetLayout.get())).front());
 
 		vk::DescriptorBufferInfo descriptorBufferInfo(m_uniformBuffer.get(), 0, sizeof(UniformBufferObject));
 		vk::DescriptorBufferInfo descriptorStorageInfo(m_outputStorageBuffer.get(), 0, sizeof(OutputStorageObject));
-		vk::DescriptorImageInfo encodeImage1(nullptr, m_renderImage->imageView.get(), vk::ImageLayout::eGeneral);
-		vk::DescriptorImageInfo encodeImageY(nullptr, m_encodedImageY->imageView.get(), vk::ImageLayout::eGeneral);
-		vk::DescriptorImageInfo encodeImageCr(nullptr, m_encodedImageCr->imageView.get(), vk::ImageLayout::eGeneral);
-		vk::DescriptorImageInfo encodeImageCb(nullptr, m_encodedImageCb->imageView.get(), vk::ImageLayout::eGeneral);
-		std::array<vk::WriteDescriptorSet, 6> writeDescriptorSets = {
-			vk::WriteDescriptorSet(m_descriptorSet.get(), 1, 0, vk::DescriptorType::eUniformBuffer, nullptr, descriptorBufferInfo, nullptr),
+		std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+			vk::WriteDescriptorSet(m_descriptorSet.get(), 1, 0, vk::DescriptorType::eUniformBufferDynamic, nullptr, descriptorBufferInfo, nullptr),
 			vk::WriteDescriptorSet(m_computeDescriptorSet.get(), 0, 0, vk::DescriptorType::eStorageBuffer, nullptr, descriptorStorageInfo, nullptr),
-
-			vk::WriteDescriptorSet(m_descriptorSetEncode.get(), 0, 0, vk::DescriptorType::eStorageImage, encodeImage1),
-			vk::WriteDescriptorSet(m_descriptorSetEncode.get(), 1, 0, vk::DescriptorType::eStorageImage, encodeImageY),
-			vk::WriteDescriptorSet(m_descriptorSetEncode.get(), 2, 0, vk::DescriptorType::eStorageImage, encodeImageCr),
-			vk::WriteDescriptorSet(m_descriptorSetEncode.get(), 3, 0, vk::DescriptorType::eStorageImage, encodeImageCb),
 		};
+		for(FrameSlot& slot : m_frames)
+		{
+			// the render image and the output buffer are only known when the slot is recorded
+			slot.encodeDescriptorSet = std::move(
+				m_device->allocateDescriptorSetsUnique(vk::DescriptorSetAllocateInfo(m_descriptorPool.get(), m_backend.m_descriptorSetLayoutEncode.get())).front());
+		}
 		m_device->updateDescriptorSets(writeDescriptorSets, nullptr);
 
-		m_pipelineLayout = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, m_descriptorSetLayout.get()));
-		m_pipelineLayoutEncode = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, m_descriptorSetLayoutEncode.get()));
-
-		std::array<vk::DescriptorSetLayout, 2> computeLayouts = {m_descriptorSetLayout.get(), m_computeDescriptorSetLayout.get()};
-		m_computePipelineLayout = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo({}, computeLayouts));
-
-		m_commandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
-									m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
+		for(FrameSlot& slot : m_frames)
+		{
+			slot.commandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+										m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
+			if(m_backend.m_dedicatedTransfer)
+			{
+				slot.transferCommandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+											m_transferCommandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
+			}
+		}
 		m_computeCommandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
 									m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
-
-		m_encodePipeline = createEncodePipeline();
-	}
-
-	static std::vector<char> readFile(const std::filesystem::path& filename)
-	{
-		std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-		if(!file.is_open())
+		m_uploadCommandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+									m_transferCommandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
+		if(m_backend.m_dedicatedTransfer)
 		{
-			throw std::runtime_error("failed to open file!");
+			m_uploadAcquireCommandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+										m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
 		}
-
-		size_t fileSize = (size_t) file.tellg();
-		std::vector<char> buffer(fileSize);
-		file.seekg(0);
-		file.read(buffer.data(), fileSize);
-
-		file.close();
-		return buffer;
 	}
 
 	vk::UniqueShaderModule VulkanBackend::createShader(const std::vector<unsigned int>& code)
@@ -444,7 +672,7 @@ namespace vulkanbot
 	}
 
 	vk::UniquePipeline VulkanBackend::createPipeline(vk::UniqueShaderModule& vertexShader, vk::UniqueShaderModule& fragmentShader,
-		vk::CullModeFlags cullMode, bool depth)
+		vk::CullModeFlags cullMode, bool depth, bool fullscreen)
 	{
 		vk::PipelineShaderStageCreateInfo vertexShaderInfo({}, vk::ShaderStageFlagBits::eVertex, vertexShader.get(), "main");
 		vk::PipelineShaderStageCreateInfo fragmentShaderInfo({}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main");
@@ -455,12 +683,15 @@ namespace vulkanbot
 
 		vk::PipelineVertexInputStateCreateInfo vertexInputInfo({},
 			bindingDescription, attributeDescriptions);
+		// the fullscreen triangle comes from gl_VertexIndex alone
+		if(fullscreen)
+			vertexInputInfo = vk::PipelineVertexInputStateCreateInfo();
 
 		vk::PipelineInputAssemblyStateCreateInfo inputAssembly({}, vk::PrimitiveTopology::eTriangleList);
-		vk::Viewport viewport(0.0f, 0.0f, static_cast<float>(m_width), static_cast<float>(m_height), 0.0f, 1.0f);
-		vk::Rect2D scissor({0, 0}, {m_width, m_height});
-
-		vk::PipelineViewportStateCreateInfo viewportState({}, 1, &viewport, 1, &scissor);
+		// set when recording, so the same pipeline renders at any size
+		vk::PipelineViewportStateCreateInfo viewportState({}, 1, nullptr, 1, nullptr);
+		std::array<vk::DynamicState, 2> dynamicStates = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+		vk::PipelineDynamicStateCreateInfo dynamicState({}, dynamicStates);
 
 		vk::PipelineRasterizationStateCreateInfo rasterizer({}, false, false, vk::PolygonMode::eFill,
 			cullMode, vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
@@ -473,12 +704,15 @@ namespace vulkanbot
 		vk::PipelineDepthStencilStateCreateInfo depthStencil({}, depth, depth, vk::CompareOp::eLessOrEqual, false);
 
 		vk::GraphicsPipelineCreateInfo pipelineInfo({}, shaderStages, &vertexInputInfo,
-			&inputAssembly, nullptr, &viewportState, &rasterizer, &multisampling, &depthStencil, &colorBlend, nullptr,
+			&inputAssembly, nullptr, &viewportState, &rasterizer, &multisampling, &depthStencil, &colorBlend, &dynamicState,
 			m_pipelineLayout.get(), m_renderPass.get());
 
 		vk::Result result;
 		vk::UniquePipeline pipeline;
-		std::tie( result, pipeline ) = m_device->createGraphicsPipelineUnique(nullptr, pipelineInfo).asTuple();
+		{
+			std::shared_lock cacheLock(m_pipelineCacheMutex);
+			std::tie( result, pipeline ) = m_device->createGraphicsPipelineUnique(m_pipelineCache.get(), pipelineInfo).asTuple();
+		}
 		switch ( result )
 		{
 			case vk::Result::eSuccess: break;
@@ -487,6 +721,7 @@ namespace vulkanbot
 				break;
 			default: assert( false );  // should never happen
 		}
+		pipelineCreated();
 
 		return pipeline;
 	}
@@ -497,8 +732,11 @@ namespace vulkanbot
 
 		vk::Result result;
 		vk::UniquePipeline pipeline;
-		std::tie( result, pipeline ) = m_device->createComputePipelineUnique(nullptr,
-			vk::ComputePipelineCreateInfo({}, computeShaderInfo, m_computePipelineLayout.get())).asTuple();
+		{
+			std::shared_lock cacheLock(m_pipelineCacheMutex);
+			std::tie( result, pipeline ) = m_device->createComputePipelineUnique(m_pipelineCache.get(),
+				vk::ComputePipelineCreateInfo({}, computeShaderInfo, m_computePipelineLayout.get())).asTuple();
+		}
 		switch ( result )
 		{
 			case vk::Result::eSuccess: break;
@@ -507,19 +745,23 @@ namespace vulkanbot
 				break;
 			default: assert( false );  // should never happen
 		}
+		pipelineCreated();
 
 		return pipeline;
 	}
 
-	vk::UniquePipeline VulkanBackend::createEncodePipeline()
+	vk::UniquePipeline VulkanBackend::createEncodePipeline(const std::string& shader)
 	{
-		vk::UniqueShaderModule computeShader = createShader(readFile(m_shadersPath / "yuv420p_encode.comp.spv"));
+		vk::UniqueShaderModule computeShader = createShader(readFile(m_shadersPath / (shader+".comp.spv")));
 		vk::PipelineShaderStageCreateInfo shaderInfo({}, vk::ShaderStageFlagBits::eCompute, computeShader.get(), "main");
 
 		vk::Result result;
 		vk::UniquePipeline pipeline;
-		std::tie( result, pipeline ) = m_device->createComputePipelineUnique(nullptr,
-			vk::ComputePipelineCreateInfo({}, shaderInfo, m_pipelineLayoutEncode.get())).asTuple();
+		{
+			std::shared_lock cacheLock(m_pipelineCacheMutex);
+			std::tie( result, pipeline ) = m_device->createComputePipelineUnique(m_pipelineCache.get(),
+				vk::ComputePipelineCreateInfo({}, shaderInfo, m_pipelineLayoutEncode.get())).asTuple();
+		}
 		switch ( result )
 		{
 			case vk::Result::eSuccess: break;
@@ -528,55 +770,49 @@ namespace vulkanbot
 				break;
 			default: assert( false );  // should never happen
 		}
+		pipelineCreated();
 
 		return pipeline;
 	}
 
-	std::tuple<bool, std::string> compileShader(EShLanguage stage, std::string glslCode, std::vector<unsigned int>& shaderCode, const std::filesystem::path& includePath)
+	void VulkanBackend::initShaderCache(std::optional<std::filesystem::path> directory, size_t maxMemoryBytes, size_t maxDiskBytes)
 	{
-		vulkan_bot::LimitedIncluder includer(includePath);
-
-		const char * shaderStrings[1];
-		shaderStrings[0] = glslCode.data();
-
-		glslang::TShader shader(stage);
-		shader.setStrings(shaderStrings, 1);
-		shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 100);
-		shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetClientVersion::EShTargetVulkan_1_1);
-		shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_3);
-		shader.setEntryPoint("main");
-		shader.setSourceEntryPoint("main");
-
-		EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
-		if(!shader.parse(GetDefaultResources(), 100, false, messages, includer))
-		{
-			return {false, std::string(shader.getInfoLog())};
-		}
+		m_shaderCache = std::make_unique<ShaderCache>(directory, maxMemoryBytes, maxDiskBytes);
+	}
 
-		glslang::TProgram program;
-		program.addShader(&shader);
-		if(!program.link(messages))
-		{
-			return {false, std::string(program.getInfoLog())};
-		}
-		glslang::GlslangToSpv(*program.getIntermediate(stage), shaderCode);
+	void VulkanBackend::configureShaderCompiler(unsigned int threads)
+	{
+		m_compilerThreads = threads;
+	}
 
-		return {true, ""};
+	ShaderCache::Stats VulkanBackend::shaderCacheStats() const
+	{
+		return m_compiler->cacheStats();
 	}
 
-	std::tuple<bool, std::string> VulkanBackend::uploadShaderMix(const std::string vertex, bool vertexFile, const std::string fragment, bool fragmentFile,
+	PipelineResult VulkanBackend::createShaderMixPipeline(const std::string& vertex, bool vertexFile, const std::string& fragment, bool fragmentFile,
 		vk::CullModeFlags cullMode, bool depth)
 	{
-		std::vector<unsigned int> vertexBin;
-		std::vector<unsigned int> fragmentBin;
-
+		auto t1 = std::chrono::high_resolution_clock::now();
 		std::tuple<bool, std::string> vertexResult = {true, ""};
 		std::tuple<bool, std::string> fragmentResult = {true, ""};
 
+		// The default vertex stage only puts the grid mesh onto the screen, for the fragment shader alone a single triangle
+		// that covers the screen does the same without the vertex and raster work of 131k triangles.
+		bool fullscreen = vertexFile && vertex == "base";
+		std::string vertexName = fullscreen ? "fullscreen" : vertex;
+
 		vk::UniqueShaderModule vertexShader;
 		vk::UniqueShaderModule fragmentShader;
 
-		glslang::InitializeProcess();
+		// start both stages before waiting for either of them
+		std::future<CompileResult> vertexCompile;
+		std::future<CompileResult> fragmentCompile;
+		if(!vertexFile)
+			vertexCompile = m_compiler->compile(EShLangVertex, vertex);
+		if(!fragmentFile)
+			fragmentCompile = m_compiler->compile(EShLangFragment, fragment);
+
 		if(vertexFile)
 		{
 			if(vertex.find("/") != std::string::npos)
@@ -585,7 +821,7 @@ namespace vulkanbot
 			{
 				try
 				{
-					vertexShader = createShader(readFile(m_shadersPath / (vertex+".vert.spv")));
+					vertexShader = createShader(readFile(m_shadersPath / (vertexName+".vert.spv")));
 				}
 				catch(const std::runtime_error& err)
 				{
@@ -595,9 +831,10 @@ namespace vulkanbot
 		}
 		else
 		{
-			vertexResult = compileShader(EShLangVertex, vertex, vertexBin, m_shaderIncludePath);
-			if(std::get<0>(vertexResult))
-				vertexShader = createShader(vertexBin);
+			CompileResult compiled = vertexCompile.get();
+			vertexResult = {compiled.success, compiled.error};
+			if(compiled.success)
+				vertexShader = createShader(compiled.spirv);
 		}
 		if(fragmentFile)
 		{
@@ -617,28 +854,31 @@ namespace vulkanbot
 		}
 		else
 		{
-			fragmentResult = compileShader(EShLangFragment, fragment, fragmentBin, m_shaderIncludePath);
-			if(std::get<0>(fragmentResult))
-				fragmentShader = createShader(fragmentBin);
+			CompileResult compiled = fragmentCompile.get();
+			fragmentResult = {compiled.success, compiled.error};
+			if(compiled.success)
+				fragmentShader = createShader(compiled.spirv);
 		}
-		glslang::FinalizeProcess();
 
 		if(!std::get<0>(vertexResult))
-			return {std::get<0>(vertexResult), "vertex: "+std::get<1>(vertexResult)};
+			return {std::get<0>(vertexResult), "vertex: "+std::get<1>(vertexResult), {}};
 		if(!std::get<0>(fragmentResult))
-			return {std::get<0>(fragmentResult), "fragment: "+std::get<1>(fragmentResult)};
+			return {std::get<0>(fragmentResult), "fragment: "+std::get<1>(fragmentResult), {}};
 
-		m_pipeline = createPipeline(vertexShader, fragmentShader, cullMode, depth);
-		return {true, ""};
+		auto t2 = std::chrono::high_resolution_clock::now();
+		PipelineResult result{true, "", createPipeline(vertexShader, fragmentShader, cullMode, depth, fullscreen), fullscreen};
+		auto t3 = std::chrono::high_resolution_clock::now();
+		result.compileTime = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+		result.pipelineTime = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count();
+		return result;
 	}
 
-	std::tuple<bool, std::string> VulkanBackend::uploadComputeShader(const std::string compute, bool file)
+	PipelineResult VulkanBackend::createComputeShaderPipeline(const std::string& compute, bool file)
 	{
-		std::vector<unsigned int> computeBin;
+		auto t1 = std::chrono::high_resolution_clock::now();
 		std::tuple<bool, std::string> computeResult = {true, ""};
 		vk::UniqueShaderModule computeShader;
 
-		glslang::InitializeProcess();
 		if(file)
 		{
 			if(compute.find("/") != std::string::npos)
@@ -657,29 +897,119 @@ namespace vulkanbot
 		}
 		else
 		{
-			computeResult = compileShader(EShLangCompute, compute, computeBin, m_shaderIncludePath);
-			if(std::get<0>(computeResult))
-				computeShader = createShader(computeBin);
+			CompileResult compiled = m_compiler->compile(EShLangCompute, compute).get();
+			computeResult = {compiled.success, compiled.error};
+			if(compiled.success)
+				computeShader = createShader(compiled.spirv);
 		}
 
 		if(!std::get<0>(computeResult))
-			return {std::get<0>(computeResult), "compute: "+std::get<1>(computeResult)};
+			return {std::get<0>(computeResult), "compute: "+std::get<1>(computeResult), {}};
+
+		auto t2 = std::chrono::high_resolution_clock::now();
+		PipelineResult result{true, "", createComputePipeline(computeShader)};
+		auto t3 = std::chrono::high_resolution_clock::now();
+		result.compileTime = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+		result.pipelineTime = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count();
+		return result;
+	}
+
+	std::tuple<bool, std::string> RenderContext::uploadShaderMix(const std::string vertex, bool vertexFile, const std::string fragment, bool fragmentFile,
+		vk::CullModeFlags cullMode, bool depth)
+	{
+		PipelineResult result = m_backend.createShaderMixPipeline(vertex, vertexFile, fragment, fragmentFile, cullMode, depth);
+		if(result.success)
+			usePipeline(std::move(result.pipeline), result.fullscreen);
+		return {result.success, result.error};
+	}
 
-		m_computePipeline = createComputePipeline(computeShader);
-		return {true, ""};
+	std::tuple<bool, std::string> RenderContext::uploadComputeShader(const std::string compute, bool file)
+	{
+		PipelineResult result = m_backend.createComputeShaderPipeline(compute, file);
+		if(result.success)
+			useComputePipeline(std::move(result.pipeline));
+		return {result.success, result.error};
+	}
+
+	void RenderContext::usePipeline(vk::UniquePipeline pipeline, bool fullscreen)
+	{
+		m_pipeline = std::move(pipeline);
+		m_fullscreen = fullscreen;
+	}
+
+	void RenderContext::useComputePipeline(vk::UniquePipeline pipeline)
+	{
+		m_computePipeline = std::move(pipeline);
+	}
+
+	void RenderContext::setExtent(uint32_t width, uint32_t height)
+	{
+		m_width = width;
+		m_height = height;
+		m_layout = frameLayout(m_format, m_width, m_height);
+	}
+
+	RenderTarget& RenderContext::target()
+	{
+		vk::Extent2D extent{m_width, m_height};
+		if(m_target && m_target->extent != extent)
+		{
+			// nothing is in flight between jobs or calls to renderFrame(s), so the old one can go
+			m_backend.releaseTarget(m_target);
+			m_target = nullptr;
+		}
+		if(!m_target)
+			m_target = m_backend.acquireTarget(extent);
+		return *m_target;
 	}
 
-	void VulkanBackend::buildCommandBuffer(Mesh* mesh, bool yuv420p)
+	void RenderContext::buildCommandBuffer(Mesh* mesh, FrameFormat format)
 	{
 		if(mesh == nullptr)
 		{
-			mesh = m_gridMesh.get();
+			mesh = m_backend.m_gridMesh.get();
+		}
+
+		// the actual recording happens per submission, because every frame can end up in a different readback buffer
+		m_mesh = mesh;
+		m_format = format;
+		m_layout = frameLayout(format, m_width, m_height);
+	}
+
+	void RenderContext::recordCommandBuffer(FrameSlot& slot, size_t slotIndex, vk::DeviceSize frameSize)
+	{
+		Mesh* mesh = m_mesh;
+		RenderTarget& target = this->target();
+		bool convert = m_format != FrameFormat::RGBA;
+		bool dedicatedTransfer = m_backend.m_dedicatedTransfer;
+		vk::Buffer outputBuffer = dedicatedTransfer ? slot.staging->buffer.get() : slot.readback->buffer.get();
+		vk::UniqueCommandBuffer& commandBuffer = slot.commandBuffer;
+
+		if(convert)
+		{
+			// the previous batch of the slot is done, so its set can be pointed at the new image and buffer
+			vk::DescriptorImageInfo imageInfo(nullptr, target.color->imageView.get(), vk::ImageLayout::eGeneral);
+			vk::DescriptorBufferInfo outputInfo(outputBuffer, 0, VK_WHOLE_SIZE);
+			std::array<vk::WriteDescriptorSet, 2> writes = {
+				vk::WriteDescriptorSet(slot.encodeDescriptorSet.get(), 0, 0, vk::DescriptorType::eStorageImage, imageInfo),
+				vk::WriteDescriptorSet(slot.encodeDescriptorSet.get(), 1, 0, vk::DescriptorType::eStorageBuffer, nullptr, outputInfo, nullptr)
+			};
+			m_device->updateDescriptorSets(writes, nullptr);
 		}
 
-		m_commandBuffer->reset();
-		m_commandBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags()));
+		commandBuffer->reset();
+		commandBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags()));
+
+		// bottom of pipe, so each timestamp waits for everything recorded before it
+		uint32_t firstTimestamp = timestampIndex(slotIndex, 0);
+		auto timestamp = [&](uint32_t query) {
+			if(m_queryPool)
+				commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_queryPool.get(), query);
+		};
+		if(m_queryPool)
+			commandBuffer->resetQueryPool(m_queryPool.get(), firstTimestamp, slot.frameCount * timestampsPerFrame);
 
-		/*m_commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
+		/*commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
 			{}, {}, {},
 			vk::ImageMemoryBarrier(
 				{}, vk::AccessFlagBits::eTransferWrite,
@@ -688,8 +1018,8 @@ namespace vulkanbot
 				m_texture->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
 		std::array<vk::BufferImageCopy, 1> regions;
 		regions[0] = vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), {0, 0, 0}, {m_textureWidth, m_textureHeight, 1});
-		m_commandBuffer->copyBufferToImage(m_inputImageBuffer.get(), m_texture->image.get(), vk::ImageLayout::eTransferDstOptimal, regions);
-		m_commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
+		commandBuffer->copyBufferToImage(m_inputImageBuffer.get(), m_texture->image.get(), vk::ImageLayout::eTransferDstOptimal, regions);
+		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
 			{}, {}, {},
 			vk::ImageMemoryBarrier(
 				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
@@ -697,182 +1027,440 @@ namespace vulkanbot
 				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
 				m_texture->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));*/
 
-		std::array<vk::ClearValue, 2> clearValues;
-		clearValues[0].color = vk::ClearColorValue(std::array<float, 4>({{0.0f, 0.0f, 0.0f, 1.0f}}));
-		clearValues[1].depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
-		m_commandBuffer->beginRenderPass(
-			vk::RenderPassBeginInfo(
-				m_renderPass.get(),
-				m_framebuffer.get(),
-				{{0, 0}, {static_cast<uint32_t>(m_width), static_cast<uint32_t>(m_height)}}, clearValues),
-			vk::SubpassContents::eInline);
-		m_commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline.get());
-		m_commandBuffer->bindVertexBuffers(0, mesh->getBuffers(), mesh->getBufferOffsets());
-		m_commandBuffer->bindIndexBuffer(mesh->indexBuffer.get(), 0, vk::IndexType::eUint16);
-		m_commandBuffer->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipelineLayout.get(), 0, m_descriptorSet.get(), nullptr);
-
-		m_commandBuffer->drawIndexed(mesh->indexCount, 1, 0, 0, 0);
-		m_commandBuffer->endRenderPass();
-
-		// I have no idea why we need this... but it works... Oh well, it's staying here.
-		m_commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
-			{}, {}, {},
-			vk::ImageMemoryBarrier(
-				vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eTransferRead,
-				vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eTransferSrcOptimal,
-				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-				m_renderImage->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
-
-		if(yuv420p)
+		for(int i=0; i<slot.frameCount; i++)
 		{
-			m_commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
-				{}, {}, {}, {
-				vk::ImageMemoryBarrier(
-					vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eShaderRead,
-					vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eGeneral,
-					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_renderImage->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-				vk::ImageMemoryBarrier(
-					{}, vk::AccessFlagBits::eShaderWrite,
-					vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
-					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_encodedImageY->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-				vk::ImageMemoryBarrier(
-					{}, vk::AccessFlagBits::eShaderWrite,
-					vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
-					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_encodedImageCr->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-				vk::ImageMemoryBarrier(
-					{}, vk::AccessFlagBits::eShaderWrite,
-					vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
-					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_encodedImageCb->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1))});
-
-			m_commandBuffer->bindPipeline(vk::PipelineBindPoint::eCompute, m_encodePipeline.get());
-			m_commandBuffer->bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipelineLayoutEncode.get(), 0, m_descriptorSetEncode.get(), {});
-			m_commandBuffer->dispatch(m_width/2, m_height/2, 1);
+			vk::DeviceSize frameOffset = i * frameSize;
+			uint32_t frameTimestamp = firstTimestamp + i * timestampsPerFrame;
+
+			// All frames share the render image, so the previous frame has to be done reading it before we draw.
+			commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eComputeShader,
+				{}, {}, {}, {});
+			timestamp(frameTimestamp);
+
+			std::array<vk::ClearValue, 2> clearValues;
+			clearValues[0].color = vk::ClearColorValue(std::array<float, 4>({{0.0f, 0.0f, 0.0f, 1.0f}}));
+			clearValues[1].depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
+			commandBuffer->beginRenderPass(
+				vk::RenderPassBeginInfo(
+					m_backend.m_renderPass.get(),
+					target.framebuffer.get(),
+					{{0, 0}, target.extent}, clearValues),
+				vk::SubpassContents::eInline);
+			commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline.get());
+			commandBuffer->setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(m_width), static_cast<float>(m_height), 0.0f, 1.0f));
+			commandBuffer->setScissor(0, vk::Rect2D({0, 0}, target.extent));
+			commandBuffer->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_backend.m_pipelineLayout.get(), 0, m_descriptorSet.get(), uniformOffset(slotIndex, i));
+			if(m_fullscreen)
+			{
+				commandBuffer->draw(3, 1, 0, 0);
+			}
+			else
+			{
+				commandBuffer->bindVertexBuffers(0, mesh->getBuffers(), mesh->getBufferOffsets());
+				commandBuffer->bindIndexBuffer(mesh->indexBuffer.get(), 0, vk::IndexType::eUint16);
+				commandBuffer->drawIndexed(mesh->indexCount, 1, 0, 0, 0);
+			}
+			commandBuffer->endRenderPass();
+			timestamp(frameTimestamp + 1);
 
-			m_commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
-				{}, {}, {}, {
-				vk::ImageMemoryBarrier(
-					vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
-					vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal,
-					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_encodedImageY->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
+			// I have no idea why we need this... but it works... Oh well, it's staying here.
+			commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
+				{}, {}, {},
 				vk::ImageMemoryBarrier(
-					vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
-					vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal,
+					vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eTransferRead,
+					vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eTransferSrcOptimal,
 					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_encodedImageCr->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-				vk::ImageMemoryBarrier(
-					vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
-					vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal,
-					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-					m_encodedImageCb->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1))});
-
-			std::array<vk::BufferImageCopy, 1> regions;
-			regions[0] = vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-				{0, 0, 0}, {m_width, m_height, 1});
-			m_commandBuffer->copyImageToBuffer(m_encodedImageY->image.get(), vk::ImageLayout::eTransferSrcOptimal, m_outputImageBuffer.get(), regions);
-
-			regions[0] = vk::BufferImageCopy(m_width*m_height, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-				{0, 0, 0}, {m_width/2, m_height/2, 1});
-			m_commandBuffer->copyImageToBuffer(m_encodedImageCr->image.get(), vk::ImageLayout::eTransferSrcOptimal, m_outputImageBuffer.get(), regions);
+					target.color->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
 
-			regions[0] = vk::BufferImageCopy(m_width*m_height * 1.25, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-				{0, 0, 0}, {m_width/2, m_height/2, 1});
-			m_commandBuffer->copyImageToBuffer(m_encodedImageCb->image.get(), vk::ImageLayout::eTransferSrcOptimal, m_outputImageBuffer.get(), regions);
+			if(convert)
+			{
+				commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
+					{}, {}, {},
+					vk::ImageMemoryBarrier(
+						vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eShaderRead,
+						vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eGeneral,
+						VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+						target.color->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+
+				// the planes go straight to where the encoder reads them, there is nothing left to copy
+				EncodeParameters parameters{
+					m_width, m_height,
+					static_cast<uint32_t>(frameOffset), m_layout.stride,
+					{static_cast<uint32_t>(frameOffset + m_layout.chromaOffset[0]), static_cast<uint32_t>(frameOffset + m_layout.chromaOffset[1])},
+					m_layout.chromaStride,
+					m_format == FrameFormat::NV12 ? 1u : 0u
+				};
+				bool indexed = m_format == FrameFormat::PAL8;
+				commandBuffer->bindPipeline(vk::PipelineBindPoint::eCompute, indexed ? m_backend.m_palettePipeline.get() : m_backend.m_encodePipeline.get());
+				commandBuffer->bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_backend.m_pipelineLayoutEncode.get(), 0, slot.encodeDescriptorSet.get(), {});
+				commandBuffer->pushConstants<EncodeParameters>(m_backend.m_pipelineLayoutEncode.get(), vk::ShaderStageFlagBits::eCompute, 0, parameters);
+				// one invocation per 4x1 tile of indices or 8x2 tile of YUV, over the padded width of the rows
+				uint32_t tilesX = indexed ? m_layout.stride / 4 : m_layout.stride / 8;
+				uint32_t tilesY = indexed ? m_height : (m_height + 1) / 2;
+				commandBuffer->dispatch((tilesX + encodeGroupSize - 1) / encodeGroupSize, (tilesY + encodeGroupSize - 1) / encodeGroupSize, 1);
+				timestamp(frameTimestamp + 2);
+			}
+			else
+			{
+				// no encode pass, it takes no time
+				timestamp(frameTimestamp + 2);
+				std::array<vk::BufferImageCopy, 1> regions = {
+					vk::BufferImageCopy(frameOffset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), {0, 0, 0}, {m_width, m_height, 1})
+				};
+				commandBuffer->copyImageToBuffer(target.color->image.get(), vk::ImageLayout::eTransferSrcOptimal, outputBuffer, regions);
+			}
+			timestamp(frameTimestamp + 3);
 		}
-		else
+
+		if(!dedicatedTransfer)
 		{
-			std::array<vk::BufferImageCopy, 1> regions = {
-				vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), {0, 0, 0}, {m_width, m_height, 1})
-			};
-			m_commandBuffer->copyImageToBuffer(m_renderImage->image.get(), vk::ImageLayout::eTransferSrcOptimal, m_outputImageBuffer.get(), regions);
+			commandBuffer->pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost,
+				{}, {},
+				vk::BufferMemoryBarrier(
+					vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead,
+					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, outputBuffer, 0, VK_WHOLE_SIZE),
+				{}
+			);
+			commandBuffer->end();
+			return;
 		}
 
-		m_commandBuffer->pipelineBarrier(
+		// Hand the staging buffer over to the transfer queue, which copies it to the readback buffer while we render the next batch.
+		// It is never handed back: whoever takes it from the pool next overwrites it anyway, the fence of the slot keeps it from going back to the pool before the copy is done.
+		uint32_t graphicsFamily = m_backend.m_graphicsQueueFamilyIndex;
+		uint32_t transferFamily = m_backend.m_transferQueueFamilyIndex;
+		vk::DeviceSize size = slot.frameCount * frameSize;
+		commandBuffer->pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe,
+			{}, {},
+			vk::BufferMemoryBarrier(
+				vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite, {},
+				graphicsFamily, transferFamily, outputBuffer, 0, VK_WHOLE_SIZE),
+			{}
+		);
+		commandBuffer->end();
+
+		vk::UniqueCommandBuffer& transferCommandBuffer = slot.transferCommandBuffer;
+		transferCommandBuffer->reset();
+		transferCommandBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags()));
+		transferCommandBuffer->pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+			{}, {},
+			vk::BufferMemoryBarrier(
+				{}, vk::AccessFlagBits::eTransferRead,
+				graphicsFamily, transferFamily, outputBuffer, 0, VK_WHOLE_SIZE),
+			{}
+		);
+		transferCommandBuffer->copyBuffer(outputBuffer, slot.readback->buffer.get(), vk::BufferCopy(0, 0, size));
+		transferCommandBuffer->pipelineBarrier(
 			vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
 			{}, {},
 			vk::BufferMemoryBarrier(
 				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead,
-				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, m_outputImageBuffer.get(), 0, VK_WHOLE_SIZE),
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, slot.readback->buffer.get(), 0, VK_WHOLE_SIZE),
 			{}
 		);
+		transferCommandBuffer->end();
+	}
 
-		m_commandBuffer->end();
+	void RenderContext::submitFrames(FrameSlot& slot)
+	{
+		if(!m_backend.m_dedicatedTransfer)
+		{
+			m_backend.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &slot.commandBuffer.get()), slot.fence.get());
+			return;
+		}
+
+		m_backend.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &slot.commandBuffer.get(), 1, &slot.rendered.get()), nullptr);
+		vk::PipelineStageFlags waitStage(vk::PipelineStageFlagBits::eTransfer);
+		m_backend.submitTransfer(vk::SubmitInfo(1, &slot.rendered.get(), &waitStage, 1, &slot.transferCommandBuffer.get()), slot.fence.get());
 	}
 
-	void VulkanBackend::buildComputeCommandBuffer(int x, int y, int z)
+	void RenderContext::buildComputeCommandBuffer(int x, int y, int z)
 	{
 		m_computeCommandBuffer->reset();
 		m_computeCommandBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags()));
 
 		m_computeCommandBuffer->bindPipeline(vk::PipelineBindPoint::eCompute, m_computePipeline.get());
-		m_computeCommandBuffer->bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_computePipelineLayout.get(), 0,
-			{m_descriptorSet.get(), m_computeDescriptorSet.get()}, {});
+		m_computeCommandBuffer->bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_backend.m_computePipelineLayout.get(), 0,
+			{m_descriptorSet.get(), m_computeDescriptorSet.get()}, uniformOffset(0, 0));
+		if(m_queryPool)
+		{
+			m_computeCommandBuffer->resetQueryPool(m_queryPool.get(), computeTimestampIndex(), 2);
+			m_computeCommandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_queryPool.get(), computeTimestampIndex());
+		}
 		m_computeCommandBuffer->dispatch(x, y, z);
+		if(m_queryPool)
+			m_computeCommandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_queryPool.get(), computeTimestampIndex() + 1);
 
 		m_computeCommandBuffer->end();
 	}
 
-	std::unique_ptr<ImageData> VulkanBackend::uploadImage(int width, int height, const std::vector<unsigned char>& data)
+	std::unique_ptr<ImageData> RenderContext::uploadImage(int width, int height, const std::vector<unsigned char>& data)
 	{
-		std::unique_ptr<ImageData> image = std::make_unique<ImageData>(m_physicalDevice, m_device, vk::Format::eR8G8B8A8Unorm,
+		std::unique_ptr<ImageData> image = std::make_unique<ImageData>(*m_backend.m_allocator, m_device, vk::Format::eR8G8B8A8Unorm,
 			vk::Extent2D(static_cast<uint32_t>(width), static_cast<uint32_t>(height)),
 			vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
 			vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-		vk::UniqueBuffer buffer = m_device->createBufferUnique(vk::BufferCreateInfo({}, data.size(), vk::BufferUsageFlagBits::eTransferSrc,
-			vk::SharingMode::eExclusive));
-		vk::MemoryRequirements memoryRequirements = m_device->getBufferMemoryRequirements(buffer.get());
-		uint32_t memoryTypeIndex = findMemoryType(m_physicalDevice.getMemoryProperties(),
-			memoryRequirements.memoryTypeBits,
-			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-		vk::UniqueDeviceMemory memory = m_device->allocateMemoryUnique(vk::MemoryAllocateInfo(memoryRequirements.size, memoryTypeIndex));
-		m_device->bindBufferMemory(buffer.get(), memory.get(), 0);
-
-		uint8_t *pData = static_cast<uint8_t *>(m_device->mapMemory(memory.get(), 0, memoryRequirements.size));
-		memcpy(pData, data.data(), data.size());
-		m_device->unmapMemory(memory.get());
-
-		vk::UniqueCommandBuffer commandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
-			m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
-		commandBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags()));
-		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
-			{}, {}, {},
-			vk::ImageMemoryBarrier(
-				{}, vk::AccessFlagBits::eTransferWrite,
-				vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
-				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-				image->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
-		std::array<vk::BufferImageCopy, 1> regions = {
-			vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), {0, 0, 0}, {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1})
-		};
-		commandBuffer->copyBufferToImage(buffer.get(), image->image.get(), vk::ImageLayout::eTransferDstOptimal, regions);
-		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands,
-			{}, {}, {},
-			vk::ImageMemoryBarrier(
+		StagingRing::Region staging = m_backend.m_staging->acquire(data.size());
+		memcpy(staging.data, data.data(), data.size());
+
+		m_backend.upload(m_uploadCommandBuffer.get(), m_uploadAcquireCommandBuffer.get(), m_uploadSemaphore.get(), m_lastUpload, staging,
+			[&](vk::CommandBuffer commandBuffer) {
+				commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+					{}, {}, {},
+					vk::ImageMemoryBarrier(
+						{}, vk::AccessFlagBits::eTransferWrite,
+						vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+						VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+						image->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+				std::array<vk::BufferImageCopy, 1> regions = {
+					vk::BufferImageCopy(staging.offset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), {0, 0, 0}, {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1})
+				};
+				commandBuffer.copyBufferToImage(staging.buffer, image->image.get(), vk::ImageLayout::eTransferDstOptimal, regions);
+			},
+			vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+			{},
+			{vk::ImageMemoryBarrier(
 				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
 				vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
 				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-				image->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
-		commandBuffer->end();
+				image->image.get(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1))});
 
-		vk::PipelineStageFlags waitDestinationStageMask(vk::PipelineStageFlagBits::eTransfer);
-		m_queue.submit(vk::SubmitInfo(0, nullptr, &waitDestinationStageMask, 1, &commandBuffer.get()), m_transferFence.get());
-		vk::Result r = m_device->waitForFences(m_transferFence.get(), true, UINT64_MAX);
-		m_device->resetFences(m_transferFence.get());
+		bindImage(*image);
 
-		assert(r == vk::Result::eSuccess);
+		return image;
+	}
 
-		vk::DescriptorImageInfo descriptorImageInfo(m_sampler.get(), image->imageView.get(), vk::ImageLayout::eShaderReadOnlyOptimal);
+	void RenderContext::bindImage(const ImageData& image)
+	{
+		vk::DescriptorImageInfo descriptorImageInfo(m_backend.m_sampler.get(), image.imageView.get(), vk::ImageLayout::eShaderReadOnlyOptimal);
 		std::array<vk::WriteDescriptorSet, 1> writeDescriptorSets = {
 			vk::WriteDescriptorSet(m_descriptorSet.get(), 0, 0, vk::DescriptorType::eCombinedImageSampler, descriptorImageInfo, nullptr, nullptr)
 		};
 		m_device->updateDescriptorSets(writeDescriptorSets, nullptr);
+	}
 
-		return image;
+	uint32_t RenderContext::uniformOffset(size_t slotIndex, int frame) const
+	{
+		return static_cast<uint32_t>((slotIndex * m_batchSize + frame) * m_uniformStride);
+	}
+
+	UniformBufferObject* RenderContext::uniformObject(size_t slotIndex, int frame)
+	{
+		return reinterpret_cast<UniformBufferObject*>(m_uniformMemory.data() + uniformOffset(slotIndex, frame));
+	}
+
+	void RenderContext::setUniformObject(const UniformBufferObject& ubo)
+	{
+		*uniformObject(0, 0) = ubo;
+	}
+
+	uint32_t RenderContext::timestampIndex(size_t slotIndex, int frame) const
+	{
+		return static_cast<uint32_t>((slotIndex * m_batchSize + frame) * timestampsPerFrame);
+	}
+
+	uint32_t RenderContext::computeTimestampIndex() const
+	{
+		return static_cast<uint32_t>(m_frames.size() * m_batchSize * timestampsPerFrame);
+	}
+
+	std::vector<uint64_t> RenderContext::readTimestamps(uint32_t first, uint32_t count)
+	{
+		if(!m_queryPool)
+			return {};
+
+		std::vector<uint64_t> timestamps(count);
+		vk::Result result = m_device->getQueryPoolResults(m_queryPool.get(), first, count, timestamps.size() * sizeof(uint64_t),
+			timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+		if(result != vk::Result::eSuccess)
+			return {};
+		return timestamps;
+	}
+
+	GpuTimings RenderContext::frameTimings(const std::vector<uint64_t>& timestamps, int frame) const
+	{
+		if(timestamps.size() < (frame + 1) * timestampsPerFrame)
+			return {};
+
+		const uint64_t* t = timestamps.data() + frame * timestampsPerFrame;
+		return {
+			.measured = true,
+			.shader = m_backend.timestampDelta(t[0], t[1]),
+			.encode = m_backend.timestampDelta(t[1], t[2]),
+			.readback = m_backend.timestampDelta(t[2], t[3]),
+		};
+	}
+
+	double VulkanBackend::timestampDelta(uint64_t from, uint64_t to) const
+	{
+		// the valid bits wrap around
+		return ((to - from) & m_timestampMask) * m_timestampPeriod / 1000.0;
+	}
+
+	void RenderContext::invalidateReadback(PooledBuffer* readback)
+	{
+		readback->memory.invalidate();
+	}
+
+	void RenderContext::acquireBuffers(FrameSlot& slot, vk::DeviceSize size)
+	{
+		slot.readback = m_backend.acquireBuffer(size, true);
+		if(m_backend.m_dedicatedTransfer)
+			slot.staging = m_backend.acquireBuffer(size, false);
+	}
+
+	void RenderContext::renderFrame(std::function<void(uint8_t*, vk::DeviceSize, int, int, vk::Result, long, const GpuTimings&)> consumer)
+	{
+		vk::DeviceSize size = m_layout.size;
+
+		FrameSlot& slot = m_frames[0];
+		acquireBuffers(slot, size);
+		slot.frameCount = 1;
+		recordCommandBuffer(slot, 0, size);
+		submitFrames(slot);
+		slot.frame = 0;
+
+		auto t1 = std::chrono::high_resolution_clock::now();
+		vk::Result r = m_device->waitForFences(slot.fence.get(), true, UINT64_MAX);
+		auto t2 = std::chrono::high_resolution_clock::now();
+		long duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
+
+		m_device->resetFences(slot.fence.get());
+		slot.frame = -1;
+		if(slot.staging)
+		{
+			slot.staging->busy = false;
+			slot.staging = nullptr;
+		}
+
+		GpuTimings timings = frameTimings(readTimestamps(timestampIndex(0, 0), timestampsPerFrame), 0);
+		invalidateReadback(slot.readback);
+		consumer(slot.readback->data, size, m_width, m_height, r, duration, timings);
+
+		slot.readback->busy = false;
+		slot.readback = nullptr;
+	}
+
+	void RenderContext::renderFrames(int count, std::function<void(int, UniformBufferObject*)> updater,
+		std::function<void(int, std::shared_ptr<uint8_t>, vk::DeviceSize, int, int, vk::Result, long, const GpuTimings&)> consumer)
+	{
+		vk::DeviceSize size = m_layout.size;
+		int batchSize = m_format == FrameFormat::RGBA ? 1 : m_batchSize;
+
+		// wait for the batch in the given slot and hand its frames to the consumer, making the slot available again
+		auto collect = [this, &consumer, size](FrameSlot& slot)
+		{
+			auto t1 = std::chrono::high_resolution_clock::now();
+			vk::Result r = m_device->waitForFences(slot.fence.get(), true, UINT64_MAX);
+			auto t2 = std::chrono::high_resolution_clock::now();
+			long duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
+
+			m_device->resetFences(slot.fence.get());
+			int first = slot.frame;
+			slot.frame = -1;
+			if(slot.staging)
+			{
+				slot.staging->busy = false;
+				slot.staging = nullptr;
+			}
+
+			size_t slotIndex = &slot - m_frames.data();
+			std::vector<uint64_t> timestamps = readTimestamps(timestampIndex(slotIndex, 0), slot.frameCount * timestampsPerFrame);
+
+			PooledBuffer* readback = slot.readback;
+			slot.readback = nullptr;
+			invalidateReadback(readback);
+			std::shared_ptr<uint8_t> batch(readback->data, [readback](uint8_t*){
+				readback->busy = false;
+			});
+			for(int i=0; i<slot.frameCount; i++)
+			{
+				consumer(first + i, std::shared_ptr<uint8_t>(batch, readback->data + i*size), size, m_width, m_height, r, duration / slot.frameCount,
+					frameTimings(timestamps, i));
+			}
+		};
+
+		// Keep up to m_frames.size() batches queued on the GPU while the consumer works on the oldest one.
+		int batches = (count + batchSize - 1) / batchSize;
+		for(int b=0; b<batches; b++)
+		{
+			size_t slotIndex = b % m_frames.size();
+			FrameSlot& slot = m_frames[slotIndex];
+			if(slot.frame >= 0)
+				collect(slot);
+
+			int first = b * batchSize;
+			slot.frameCount = std::min(batchSize, count - first);
+			for(int i=0; i<slot.frameCount; i++)
+			{
+				updater(first + i, uniformObject(slotIndex, i));
+			}
+
+			// sized for a whole batch even if this one is shorter, so the buffers of the other batches fit it
+			acquireBuffers(slot, size * batchSize);
+			recordCommandBuffer(slot, slotIndex, size);
+
+			submitFrames(slot);
+			slot.frame = first;
+		}
+		for(size_t i=0; i<m_frames.size(); i++)
+		{
+			FrameSlot& slot = m_frames[(batches + i) % m_frames.size()];
+			if(slot.frame >= 0)
+				collect(slot);
+		}
+	}
+
+	void RenderContext::release()
+	{
+		for(FrameSlot& slot : m_frames)
+		{
+			if(slot.frame >= 0)
+			{
+				if(m_device->waitForFences(slot.fence.get(), true, UINT64_MAX) != vk::Result::eSuccess)
+					std::cerr << "Context " << m_index << " failed to wait for its last frames" << std::endl;
+				m_device->resetFences(slot.fence.get());
+				slot.frame = -1;
+			}
+			// left behind if the job was cut short before its frames reached the consumer
+			if(slot.readback)
+				slot.readback->busy = false;
+			if(slot.staging)
+				slot.staging->busy = false;
+			slot.readback = nullptr;
+			slot.staging = nullptr;
+		}
+		if(m_target)
+		{
+			m_backend.releaseTarget(m_target);
+			m_target = nullptr;
+		}
+		setExtent(m_backend.m_width, m_backend.m_height);
+	}
+
+	void RenderContext::doComputation(std::function<void(OutputStorageObject*, vk::Result, long, const GpuTimings&)> consumer)
+	{
+		vk::PipelineStageFlags waitDestinationStageMask(vk::PipelineStageFlagBits::eComputeShader);
+		m_backend.submit(vk::SubmitInfo(0, nullptr, &waitDestinationStageMask, 1, &m_computeCommandBuffer.get()), m_fence.get());
+
+		auto t1 = std::chrono::high_resolution_clock::now();
+		vk::Result r = m_device->waitForFences(m_fence.get(), true, UINT64_MAX);
+		auto t2 = std::chrono::high_resolution_clock::now();
+		long duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
+
+		m_device->resetFences(m_fence.get());
+
+		GpuTimings timings;
+		std::vector<uint64_t> timestamps = readTimestamps(computeTimestampIndex(), 2);
+		if(timestamps.size() == 2)
+			timings = {.measured = true, .shader = m_backend.timestampDelta(timestamps[0], timestamps[1])};
+
+		consumer(reinterpret_cast<OutputStorageObject*>(m_outputStorageMemory.data()), r, duration, timings);
 	}
 
 	std::unique_ptr<Mesh> VulkanBackend::uploadMesh(std::vector<glm::vec3> vertices,
@@ -880,7 +1468,7 @@ namespace vulkanbot
 													std::vector<glm::vec3> normals,
 													std::vector<uint16_t> indices)
 	{
-		std::unique_ptr<Mesh> mesh = std::make_unique<Mesh>(m_physicalDevice, m_device, vertices.size(), indices.size());
+		std::unique_ptr<Mesh> mesh = std::make_unique<Mesh>(*m_allocator, m_device, vertices.size(), indices.size());
 
 		size_t vertexSize = vertices.size() * sizeof(glm::vec3);
 		size_t texCoordSize = texCoords.size() * sizeof(glm::vec2);
@@ -888,88 +1476,376 @@ namespace vulkanbot
 		size_t indexSize = indices.size() * sizeof(uint16_t);
 		size_t totalSize = vertexSize + texCoordSize + normalSize + indexSize;
 
-		vk::UniqueBuffer srcBuffer = m_device->createBufferUnique(vk::BufferCreateInfo({}, totalSize,
-			vk::BufferUsageFlagBits::eTransferSrc));
-
-		vk::MemoryRequirements memoryRequirements = m_device->getBufferMemoryRequirements(srcBuffer.get());
-		uint32_t memoryTypeIndex = findMemoryType(m_physicalDevice.getMemoryProperties(), memoryRequirements.memoryTypeBits,
-			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-		vk::UniqueDeviceMemory memory = m_device->allocateMemoryUnique(vk::MemoryAllocateInfo(memoryRequirements.size, memoryTypeIndex));
-
-		m_device->bindBufferMemory(srcBuffer.get(), memory.get(), 0);
-
-		uint8_t *pData = static_cast<uint8_t *>(m_device->mapMemory(memory.get(), 0, totalSize));
+		StagingRing::Region staging = m_staging->acquire(totalSize);
+		uint8_t *pData = staging.data;
 		memcpy(pData + 0, vertices.data(), vertexSize);
 		memcpy(pData + vertexSize, texCoords.data(), texCoordSize);
 		memcpy(pData + vertexSize + texCoordSize, normals.data(), normalSize);
 		memcpy(pData + vertexSize + texCoordSize + normalSize, indices.data(), indexSize);
-		m_device->unmapMemory(memory.get());
 
-		vk::UniqueCommandBuffer commandBuffer = std::move(m_device->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
-			m_commandPool.get(), vk::CommandBufferLevel::ePrimary, 1)).front());
-		commandBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags()));
-		commandBuffer->copyBuffer(srcBuffer.get(), mesh->vertexBuffer.get(), 	vk::BufferCopy(0, 0, vertexSize));
-		commandBuffer->copyBuffer(srcBuffer.get(), mesh->texCoordBuffer.get(), 	vk::BufferCopy(vertexSize, 0, texCoordSize));
-		commandBuffer->copyBuffer(srcBuffer.get(), mesh->normalBuffer.get(), 	vk::BufferCopy(vertexSize + texCoordSize, 0, normalSize));
-		commandBuffer->copyBuffer(srcBuffer.get(), mesh->indexBuffer.get(), 	vk::BufferCopy(vertexSize + texCoordSize + normalSize, 0, indexSize));
-		commandBuffer->end();
-
-		vk::PipelineStageFlags waitDestinationStageMask(vk::PipelineStageFlagBits::eTransfer);
-		m_queue.submit(vk::SubmitInfo(0, nullptr, &waitDestinationStageMask, 1, &commandBuffer.get()), m_transferFence.get());
-		vk::Result r = m_device->waitForFences(m_transferFence.get(), true, UINT64_MAX);
-		m_device->resetFences(m_transferFence.get());
+		auto bufferBarrier = [](vk::Buffer buffer, vk::AccessFlags access) {
+			return vk::BufferMemoryBarrier(vk::AccessFlagBits::eTransferWrite, access,
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, buffer, 0, VK_WHOLE_SIZE);
+		};
 
-		assert(r == vk::Result::eSuccess);
+		std::unique_lock lock(m_uploadMutex);
+		upload(m_uploadCommandBuffer.get(), m_uploadAcquireCommandBuffer.get(), m_uploadSemaphore.get(), m_lastUpload, staging,
+			[&](vk::CommandBuffer commandBuffer) {
+				vk::DeviceSize offset = staging.offset;
+				commandBuffer.copyBuffer(staging.buffer, mesh->vertexBuffer.get(), 	vk::BufferCopy(offset, 0, vertexSize));
+				commandBuffer.copyBuffer(staging.buffer, mesh->texCoordBuffer.get(), 	vk::BufferCopy(offset + vertexSize, 0, texCoordSize));
+				commandBuffer.copyBuffer(staging.buffer, mesh->normalBuffer.get(), 	vk::BufferCopy(offset + vertexSize + texCoordSize, 0, normalSize));
+				commandBuffer.copyBuffer(staging.buffer, mesh->indexBuffer.get(), 	vk::BufferCopy(offset + vertexSize + texCoordSize + normalSize, 0, indexSize));
+			},
+			vk::PipelineStageFlagBits::eVertexInput,
+			{
+				bufferBarrier(mesh->vertexBuffer.get(), vk::AccessFlagBits::eVertexAttributeRead),
+				bufferBarrier(mesh->texCoordBuffer.get(), vk::AccessFlagBits::eVertexAttributeRead),
+				bufferBarrier(mesh->normalBuffer.get(), vk::AccessFlagBits::eVertexAttributeRead),
+				bufferBarrier(mesh->indexBuffer.get(), vk::AccessFlagBits::eIndexRead),
+			},
+			{});
 
 		return mesh;
 	}
 
-	void VulkanBackend::updateUniformObject(std::function<void(UniformBufferObject*)> updater)
+	void VulkanBackend::submit(const vk::SubmitInfo& submitInfo, vk::Fence fence)
 	{
-		uint8_t *pData = static_cast<uint8_t *>(m_device->mapMemory(m_uniformMemory.get(), 0, sizeof(UniformBufferObject)));
-		updater((UniformBufferObject*)pData);
-		m_device->unmapMemory(m_uniformMemory.get());
+		std::unique_lock lock(m_queueMutex);
+		m_queue.submit(submitInfo, fence);
 	}
 
-	void VulkanBackend::renderFrame(std::function<void(uint8_t*, vk::DeviceSize, int, int, vk::Result, long)> consumer, bool yuv420p)
+	void VulkanBackend::submitTransfer(const vk::SubmitInfo& submitInfo, vk::Fence fence)
 	{
-		m_queue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &m_commandBuffer.get()), m_fence.get());
+		if(!m_dedicatedTransfer)
+		{
+			submit(submitInfo, fence);
+			return;
+		}
+		std::unique_lock lock(m_transferQueueMutex);
+		m_transferQueue.submit(submitInfo, fence);
+	}
 
-		auto t1 = std::chrono::high_resolution_clock::now();
-		vk::Result r = m_device->waitForFences(m_fence.get(), true, UINT64_MAX);
-		auto t2 = std::chrono::high_resolution_clock::now();
-		long duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
+	void VulkanBackend::upload(vk::CommandBuffer transferCommandBuffer, vk::CommandBuffer acquireCommandBuffer, vk::Semaphore semaphore,
+		std::optional<StagingRing::Region>& lastUpload, const StagingRing::Region& staging, const std::function<void(vk::CommandBuffer)>& record, vk::PipelineStageFlags dstStage,
+		std::vector<vk::BufferMemoryBarrier> bufferBarriers, std::vector<vk::ImageMemoryBarrier> imageBarriers)
+	{
+		if(lastUpload)
+			m_staging->wait(*lastUpload);
+		lastUpload = staging;
+		// The region goes back to the ring unused if anything up to the last submission fails, otherwise it would stay the
+		// oldest one in the ring forever and every later acquire would block on it.
+		bool recording = false;
+		bool transferSubmitted = false;
+		try
+		{
+			transferCommandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+			recording = true;
+			record(transferCommandBuffer);
 
-		m_device->resetFences(m_fence.get());
+			if(!m_dedicatedTransfer)
+			{
+				transferCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dstStage, {}, {}, bufferBarriers, imageBarriers);
+				transferCommandBuffer.end();
+				recording = false;
+				submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &transferCommandBuffer), staging.fence);
+			}
+			else
+			{
+				// The same barriers release the resources on the transfer queue and acquire them on the graphics queue,
+				// each side only does its half of the access masks, the layout transition happens once in between.
+				for(auto& barrier : bufferBarriers)
+				{
+					barrier.srcQueueFamilyIndex = m_transferQueueFamilyIndex;
+					barrier.dstQueueFamilyIndex = m_graphicsQueueFamilyIndex;
+				}
+				for(auto& barrier : imageBarriers)
+				{
+					barrier.srcQueueFamilyIndex = m_transferQueueFamilyIndex;
+					barrier.dstQueueFamilyIndex = m_graphicsQueueFamilyIndex;
+				}
+				std::vector<vk::BufferMemoryBarrier> releaseBuffers = bufferBarriers;
+				std::vector<vk::ImageMemoryBarrier> releaseImages = imageBarriers;
+				for(auto& barrier : releaseBuffers)
+					barrier.dstAccessMask = {};
+				for(auto& barrier : releaseImages)
+					barrier.dstAccessMask = {};
+				for(auto& barrier : bufferBarriers)
+					barrier.srcAccessMask = {};
+				for(auto& barrier : imageBarriers)
+					barrier.srcAccessMask = {};
+
+				transferCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+					{}, {}, releaseBuffers, releaseImages);
+				transferCommandBuffer.end();
+				recording = false;
+				submitTransfer(vk::SubmitInfo(0, nullptr, nullptr, 1, &transferCommandBuffer, 1, &semaphore), nullptr);
+				transferSubmitted = true;
+
+				// The graphics queue waits for the transfer on the GPU before acquiring, so its fence tells when the staging region
+				// and both command buffers are free again. Whatever is submitted to the graphics queue later to use the resources
+				// is ordered after the acquire barrier, the caller does not have to wait for anything.
+				acquireCommandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+				acquireCommandBuffer.pipelineBarrier(dstStage, dstStage, {}, {}, bufferBarriers, imageBarriers);
+				acquireCommandBuffer.end();
+				submit(vk::SubmitInfo(1, &semaphore, &dstStage, 1, &acquireCommandBuffer), staging.fence);
+			}
+		}
+		catch(...)
+		{
+			if(recording)
+				transferCommandBuffer.end();
+			// without the acquire submission there is no fence for the copies that already went out
+			if(transferSubmitted)
+			{
+				std::unique_lock lock(m_transferQueueMutex);
+				try
+				{
+					m_transferQueue.waitIdle();
+				}
+				catch(const vk::SystemError&)
+				{
+					// the device is lost, nothing is going to read the region anymore
+				}
+			}
+			m_staging->release(staging, false);
+			throw;
+		}
 
-		auto size = (m_width * m_height) * (yuv420p ? 1.5 : 4);
-		uint8_t *pData = static_cast<uint8_t *>(m_device->mapMemory(m_outputImageMemory.get(), 0, size));
-		consumer(pData, size, m_width, m_height, r, duration);
-		m_device->unmapMemory(m_outputImageMemory.get());
+		// later submissions to the graphics queue are ordered after the barrier, the ring reclaims the region once the fence is signaled
+		m_staging->release(staging);
 	}
 
-	void VulkanBackend::doComputation(std::function<void(OutputStorageObject*, vk::Result, long)> consumer)
+	void VulkanBackend::configureFramePool(size_t idleBytes)
 	{
-		vk::PipelineStageFlags waitDestinationStageMask(vk::PipelineStageFlagBits::eComputeShader);
-		m_queue.submit(vk::SubmitInfo(0, nullptr, &waitDestinationStageMask, 1, &m_computeCommandBuffer.get()), m_fence.get());
+		m_framePoolBudget = idleBytes;
+	}
 
-		auto t1 = std::chrono::high_resolution_clock::now();
-		vk::Result r = m_device->waitForFences(m_fence.get(), true, UINT64_MAX);
-		auto t2 = std::chrono::high_resolution_clock::now();
-		long duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
+	RenderTarget* VulkanBackend::acquireTarget(vk::Extent2D extent)
+	{
+		std::unique_lock lock(m_framePoolMutex);
+		RenderTarget* target = nullptr;
+		for(auto& t : m_targets)
+		{
+			if(!t->busy && t->extent == extent)
+			{
+				target = t.get();
+				break;
+			}
+		}
+		if(!target)
+		{
+			std::unique_ptr<RenderTarget> created = std::make_unique<RenderTarget>();
+			created->extent = extent;
+			created->color = std::make_unique<ImageData>(*m_allocator, m_device, vk::Format::eR8G8B8A8Unorm, extent,
+				vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eStorage,
+				vk::MemoryPropertyFlagBits::eDeviceLocal);
+			created->depth = std::make_unique<ImageData>(*m_allocator, m_device, vk::Format::eD32Sfloat, extent,
+				vk::ImageUsageFlagBits::eDepthStencilAttachment,
+				vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eDepth);
+
+			std::array<vk::ImageView, 2> attachments = {
+				created->color->imageView.get(),
+				created->depth->imageView.get()
+			};
+			created->framebuffer = m_device->createFramebufferUnique(
+				vk::FramebufferCreateInfo({}, m_renderPass.get(), attachments, extent.width, extent.height, 1));
 
-		m_device->resetFences(m_fence.get());
+			std::cout << "Creating render target " << extent.width << "x" << extent.height << std::endl;
+			target = created.get();
+			m_targets.push_back(std::move(created));
+			m_framePoolCreated++;
+		}
+		target->busy = true;
+		target->lastUsed = std::chrono::steady_clock::now();
+		trimFramePool();
+		return target;
+	}
 
-		OutputStorageObject *pData = static_cast<OutputStorageObject*>(m_device->mapMemory(m_outputStorageMemory.get(), 0, sizeof(OutputStorageObject)));
-		consumer(pData, r, duration);
-		m_device->unmapMemory(m_outputStorageMemory.get());
+	void VulkanBackend::releaseTarget(RenderTarget* target)
+	{
+		std::unique_lock lock(m_framePoolMutex);
+		target->busy = false;
+		target->lastUsed = std::chrono::steady_clock::now();
+		trimFramePool();
+	}
+
+	std::unique_ptr<PooledBuffer> VulkanBackend::createPooledBuffer(vk::DeviceSize size, bool host)
+	{
+		std::unique_ptr<PooledBuffer> pooled = std::make_unique<PooledBuffer>();
+		pooled->size = size;
+		pooled->host = host;
+
+		vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
+		if(!host)
+			usage |= vk::BufferUsageFlagBits::eTransferSrc;
+		pooled->buffer = m_device->createBufferUnique(vk::BufferCreateInfo(vk::BufferCreateFlags(), size, usage));
+
+		if(host)
+		{
+			// The CPU reads every byte of these buffers, so cached memory is a lot faster than the usual write-combined one.
+			pooled->memory = m_allocator->allocate(pooled->buffer.get(), vk::MemoryPropertyFlagBits::eHostVisible,
+				vk::MemoryPropertyFlagBits::eHostCached);
+			pooled->data = pooled->memory.data();
+		}
+		else
+		{
+			pooled->memory = m_allocator->allocate(pooled->buffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+		}
+
+		return pooled;
+	}
+
+	PooledBuffer* VulkanBackend::acquireBuffer(vk::DeviceSize size, bool host)
+	{
+		std::unique_lock lock(m_framePoolMutex);
+		PooledBuffer* pooled = nullptr;
+		for(auto& buffer : m_pooledBuffers)
+		{
+			// only ever set busy with the lock held, so nobody else can take it in between
+			if(buffer->size == size && buffer->host == host && !buffer->busy)
+			{
+				pooled = buffer.get();
+				break;
+			}
+		}
+		if(!pooled)
+		{
+			m_pooledBuffers.push_back(createPooledBuffer(size, host));
+			pooled = m_pooledBuffers.back().get();
+			m_framePoolCreated++;
+			std::cout << "Creating " << (host ? "readback" : "staging") << " buffer of " << size << " bytes, "
+				<< m_pooledBuffers.size() << " buffers in the frame pool" << std::endl;
+		}
+		pooled->busy = true;
+		pooled->lastUsed = std::chrono::steady_clock::now();
+		trimFramePool();
+		return pooled;
+	}
+
+	static vk::DeviceSize targetBytes(const RenderTarget& target)
+	{
+		return target.color->size + target.depth->size;
+	}
+
+	void VulkanBackend::trimFramePool()
+	{
+		// Buffers are released by their consumers without the lock, so some of them may already be idle without being counted,
+		// they are picked up by the next trim. They are only ever marked busy with the lock held, which keeps those counted correct.
+		vk::DeviceSize idle = 0;
+		for(auto& target : m_targets)
+		{
+			if(!target->busy)
+				idle += targetBytes(*target);
+		}
+		for(auto& buffer : m_pooledBuffers)
+		{
+			if(!buffer->busy)
+				idle += buffer->size;
+		}
+
+		while(idle > m_framePoolBudget)
+		{
+			auto oldestTarget = m_targets.end();
+			for(auto it = m_targets.begin(); it != m_targets.end(); it++)
+			{
+				if(!(*it)->busy && (oldestTarget == m_targets.end() || (*it)->lastUsed < (*oldestTarget)->lastUsed))
+					oldestTarget = it;
+			}
+			auto oldestBuffer = m_pooledBuffers.end();
+			for(auto it = m_pooledBuffers.begin(); it != m_pooledBuffers.end(); it++)
+			{
+				if(!(*it)->busy && (oldestBuffer == m_pooledBuffers.end() || (*it)->lastUsed < (*oldestBuffer)->lastUsed))
+					oldestBuffer = it;
+			}
+
+			if(oldestTarget != m_targets.end() &&
+				(oldestBuffer == m_pooledBuffers.end() || (*oldestTarget)->lastUsed <= (*oldestBuffer)->lastUsed))
+			{
+				idle -= std::min(idle, targetBytes(**oldestTarget));
+				m_targets.erase(oldestTarget);
+			}
+			else if(oldestBuffer != m_pooledBuffers.end())
+			{
+				idle -= std::min(idle, (*oldestBuffer)->size);
+				m_pooledBuffers.erase(oldestBuffer);
+			}
+			else
+			{
+				break;
+			}
+			m_framePoolEvicted++;
+		}
+	}
+
+	FramePoolStats VulkanBackend::framePoolStats() const
+	{
+		std::unique_lock lock(m_framePoolMutex);
+		FramePoolStats stats{0, 0, m_framePoolCreated, m_framePoolEvicted};
+		for(auto& target : m_targets)
+		{
+			(target->busy ? stats.busyBytes : stats.idleBytes) += targetBytes(*target);
+		}
+		for(auto& buffer : m_pooledBuffers)
+		{
+			(buffer->busy ? stats.busyBytes : stats.idleBytes) += buffer->size;
+		}
+		return stats;
+	}
+
+	void VulkanBackend::configureStaging(vk::DeviceSize bytes)
+	{
+		m_stagingSize = bytes;
+	}
+
+	DeviceAllocator::Stats VulkanBackend::allocatorStats() const
+	{
+		return m_allocator->stats();
+	}
+
+	StagingRing::Stats VulkanBackend::stagingStats() const
+	{
+		return m_staging->stats();
+	}
+
+	std::string VulkanBackend::deviceName() const
+	{
+		return m_physicalDevice.getProperties().deviceName;
+	}
+
+	std::shared_ptr<RenderContext> VulkanBackend::acquireContext()
+	{
+		std::unique_lock lock(m_contextMutex);
+		m_contextAvailable.wait(lock, [this](){ return !m_idleContexts.empty(); });
+		RenderContext* context = m_idleContexts.back();
+		m_idleContexts.pop_back();
+
+		return std::shared_ptr<RenderContext>(context, [this](RenderContext* context){
+			context->release();
+			{
+				std::unique_lock lock(m_contextMutex);
+				m_idleContexts.push_back(context);
+			}
+			m_contextAvailable.notify_one();
+		});
 	}
 
 	VulkanBackend::~VulkanBackend()
 	{
-		if(m_renderImage)
-			delete m_renderImage;
-		if(m_depthImage)
-			delete m_depthImage;
+		if(m_pipelineCacheSaverThread.joinable())
+		{
+			{
+				std::unique_lock lock(m_pipelineCacheSaverMutex);
+				m_pipelineCacheSaverStop = true;
+			}
+			m_pipelineCacheSaverWake.notify_all();
+			m_pipelineCacheSaverThread.join();
+		}
+		if(m_device)
+		{
+			// contexts may still have work queued by jobs that were cut short
+			m_device->waitIdle();
+			savePipelineCache();
+		}
 	}
 }
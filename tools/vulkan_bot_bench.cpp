@@ -0,0 +1,360 @@
+// Renders every message under examples/ through the same stages as the bot, without Discord, and reports how long each stage took.
+//
+// vulkan_bot_bench [--examples DIR] [--shaders DIR] [--shader-include DIR] [--resolution WxH]... [--iterations N] [--frames N]
+//                  [--texture PNG] [--compression fast|default|max] [--warm-cache] [--output FILE]
+//
+// The JSON report goes to --output or stdout, everything the backend logs goes to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <av.h>
+#include <avutils.h>
+#include <lodepng.h>
+#include <nlohmann/json.hpp>
+
+#include "png_encoder.h"
+#include "shader_parser.h"
+#include "video_encoder.h"
+#include "vulkan_backend.h"
+
+using namespace vulkanbot;
+
+struct Options {
+	std::filesystem::path examples = "examples";
+	std::filesystem::path shaders = "shaders";
+	std::filesystem::path shaderInclude = "shader_include";
+	std::vector<std::pair<int, int>> resolutions;
+	int iterations = 5;
+	std::optional<int> frames;
+	std::optional<std::filesystem::path> texture;
+	std::optional<std::filesystem::path> output;
+	PngCompression compression = PngCompression::Default;
+	bool warmCache = false;
+};
+
+struct Example {
+	std::string name;
+	shader vert{.data = "base", .type = shader_type::vert, .file = true};
+	shader frag{.data = "base", .type = shader_type::frag, .file = true};
+	// from the "animated" line of the example, if there is one
+	animation video{.frames = 60, .fps = 60};
+};
+
+struct Texture {
+	uint32_t width;
+	uint32_t height;
+	std::vector<unsigned char> pixels;
+};
+
+// samples of one stage in μs
+using Samples = std::map<std::string, std::vector<long>>;
+
+static long elapsed(std::chrono::high_resolution_clock::time_point since)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - since).count();
+}
+
+static std::optional<std::pair<int, int>> parseResolution(const std::string& s)
+{
+	int width, height;
+	char x;
+	std::istringstream stream(s);
+	if(!(stream >> width >> x >> height) || x != 'x' || width <= 0 || height <= 0 || width % 2 || height % 2)
+		return std::nullopt;
+	return std::make_pair(width, height);
+}
+
+static std::optional<Example> loadExample(const std::filesystem::path& path, const std::filesystem::path& root, std::string& error)
+{
+	std::ifstream file(path);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	std::string message = buffer.str();
+
+	Example example;
+	example.name = std::filesystem::relative(path, root).replace_extension().string();
+
+	for(const shader& s : find_shaders(message, shader_type::frag))
+	{
+		if(s.type == shader_type::vert)
+			example.vert = s;
+		else if(s.type == shader_type::frag)
+			example.frag = s;
+		else
+		{
+			error = "only vertex and fragment shaders are supported";
+			return std::nullopt;
+		}
+	}
+
+	if(std::optional<animation> video = find_animation(message))
+		example.video = *video;
+	return example;
+}
+
+static Texture defaultTexture()
+{
+	Texture texture{512, 512, std::vector<unsigned char>(512*512*4)};
+	for(uint32_t y=0; y<texture.height; y++)
+	{
+		for(uint32_t x=0; x<texture.width; x++)
+		{
+			unsigned char* pixel = &texture.pixels[(y*texture.width + x)*4];
+			pixel[0] = x / 2;
+			pixel[1] = y / 2;
+			pixel[2] = ((x / 32) + (y / 32)) % 2 ? 255 : 0;
+			pixel[3] = 255;
+		}
+	}
+	return texture;
+}
+
+// the shader cache would turn every compile after the first into a lookup, a comment changes the key without changing the code
+static shader salted(shader s, int iteration, bool warmCache)
+{
+	if(!s.file && !warmCache)
+		s.data += "\n// vulkan_bot_bench " + std::to_string(iteration) + "\n";
+	return s;
+}
+
+static void runExample(VulkanBackend& backend, int width, int height, const Example& example, const Texture& texture, const Options& options, int iteration, Samples& samples)
+{
+	shader vert = salted(example.vert, iteration, options.warmCache);
+	shader frag = salted(example.frag, iteration, options.warmCache);
+	PipelineResult pipeline = backend.createShaderMixPipeline(vert.data, vert.file, frag.data, frag.file, vk::CullModeFlagBits::eFront, true);
+	if(!pipeline.success)
+		throw std::runtime_error(pipeline.error);
+	samples["compile"].push_back(pipeline.compileTime);
+	samples["pipeline"].push_back(pipeline.pipelineTime);
+
+	std::shared_ptr<RenderContext> context = backend.acquireContext();
+	context->usePipeline(std::move(pipeline.pipeline), pipeline.fullscreen);
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::unique_ptr<ImageData> image = context->uploadImage(texture.width, texture.height, texture.pixels);
+	samples["texture_upload"].push_back(elapsed(t1));
+
+	context->buildCommandBuffer(nullptr, FrameFormat::RGBA);
+	context->setUniformObject({.time = example.video.tStart, .random = 0.5f});
+	context->renderFrame([&](uint8_t* data, vk::DeviceSize size, int width, int height, vk::Result result, long time, const GpuTimings& timings){
+		samples["render"].push_back(time);
+		if(timings.measured)
+		{
+			samples["gpu_shader"].push_back(std::lround(timings.shader));
+			samples["gpu_readback"].push_back(std::lround(timings.readback));
+		}
+
+		// encoded straight from the mapped readback buffer like the bot does, the copy into it is gpu_readback
+		auto t1 = std::chrono::high_resolution_clock::now();
+		std::string png = encodePng(data, width, height, options.compression);
+		samples["png_encode"].push_back(elapsed(t1));
+	});
+
+	const animation& video = example.video;
+	int frames = options.frames.value_or(video.frames);
+	auto t2 = std::chrono::high_resolution_clock::now();
+	{
+		VideoEncoder encoder(width, height, video.fps, video.bitrate > 0 ? video.bitrate : 1000000);
+		context->buildCommandBuffer(nullptr, FrameFormat::YUV420P);
+		context->renderFrames(frames, [&](int i, UniformBufferObject* ubo){
+			ubo->time = ((video.tEnd-video.tStart)/frames)*i + video.tStart;
+			ubo->random = 0.5f;
+		}, [&](int i, std::shared_ptr<uint8_t> data, vk::DeviceSize size, int width, int height, vk::Result result, long time,
+			const GpuTimings& timings){
+			samples["render_yuv"].push_back(time);
+			if(timings.measured)
+			{
+				samples["gpu_shader_yuv"].push_back(std::lround(timings.shader));
+				samples["gpu_encode_yuv"].push_back(std::lround(timings.encode));
+				samples["gpu_readback_yuv"].push_back(std::lround(timings.readback));
+			}
+
+			auto t1 = std::chrono::high_resolution_clock::now();
+			encoder.encode(i, std::move(data), size);
+			samples["video_encode"].push_back(elapsed(t1));
+		});
+		encoder.finish();
+	}
+	samples["video"].push_back(elapsed(t2));
+}
+
+static nlohmann::json summarize(Samples& samples)
+{
+	nlohmann::json stages = nlohmann::json::object();
+	for(auto& [stage, values] : samples)
+	{
+		std::sort(values.begin(), values.end());
+		// nearest rank
+		auto percentile = [&](double p) {
+			size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+			return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+		};
+		stages[stage] = {
+			{"count", values.size()},
+			{"min", values.front()},
+			{"median", percentile(0.5)},
+			{"p99", percentile(0.99)},
+		};
+	}
+	return stages;
+}
+
+static void usage(const char* name)
+{
+	std::cerr << "Usage: " << name << " [--examples DIR] [--shaders DIR] [--shader-include DIR] [--resolution WxH]... [--iterations N]"
+		" [--frames N] [--texture PNG] [--compression fast|default|max] [--warm-cache] [--output FILE]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for(int i=1; i<argc; i++)
+	{
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string {
+			if(i + 1 >= argc)
+			{
+				usage(argv[0]);
+				exit(2);
+			}
+			return argv[++i];
+		};
+
+		if(arg == "--examples")
+			options.examples = value();
+		else if(arg == "--shaders")
+			options.shaders = value();
+		else if(arg == "--shader-include")
+			options.shaderInclude = value();
+		else if(arg == "--resolution")
+		{
+			std::string s = value();
+			std::optional<std::pair<int, int>> resolution = parseResolution(s);
+			if(!resolution)
+			{
+				std::cerr << "Invalid resolution " << s << ", expected an even WIDTHxHEIGHT" << std::endl;
+				return 2;
+			}
+			options.resolutions.push_back(*resolution);
+		}
+		else if(arg == "--iterations")
+			options.iterations = std::max(std::stoi(value()), 1);
+		else if(arg == "--frames")
+			options.frames = std::max(std::stoi(value()), 1);
+		else if(arg == "--texture")
+			options.texture = value();
+		else if(arg == "--compression")
+		{
+			std::string s = value();
+			std::optional<PngCompression> compression = parsePngCompression(s);
+			if(!compression)
+			{
+				std::cerr << "Unknown compression " << s << std::endl;
+				return 2;
+			}
+			options.compression = *compression;
+		}
+		else if(arg == "--warm-cache")
+			options.warmCache = true;
+		else if(arg == "--output")
+			options.output = value();
+		else
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(options.resolutions.empty())
+		options.resolutions.push_back({1024, 1024});
+
+	// the backend logs to stdout, keep it clean for the report
+	std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+	av::init();
+	av::setFFmpegLoggingLevel(AV_LOG_ERROR);
+
+	Texture texture = defaultTexture();
+	if(options.texture)
+	{
+		if(unsigned int error = lodepng::decode(texture.pixels, texture.width, texture.height, options.texture->string()))
+		{
+			std::cerr << "Failed to decode texture " << *options.texture << ": " << lodepng_error_text(error) << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<std::filesystem::path> paths;
+	for(const auto& entry : std::filesystem::recursive_directory_iterator(options.examples))
+	{
+		if(entry.is_regular_file() && entry.path().extension() == ".txt")
+			paths.push_back(entry.path());
+	}
+	std::sort(paths.begin(), paths.end());
+
+	nlohmann::json report = {
+		{"unit", "us"},
+		{"iterations", options.iterations},
+		{"warmCache", options.warmCache},
+		{"results", nlohmann::json::array()},
+	};
+
+	for(auto [width, height] : options.resolutions)
+	{
+		VulkanBackend backend;
+		backend.initVulkan(width, height, 1, 3, 4, options.shaders, options.shaderInclude);
+		report["device"] = backend.deviceName();
+
+		for(const std::filesystem::path& path : paths)
+		{
+			std::string error;
+			std::optional<Example> example = loadExample(path, options.examples, error);
+
+			nlohmann::json result = {
+				{"example", example ? example->name : path.string()},
+				{"width", width},
+				{"height", height},
+			};
+			if(example)
+				result["frames"] = options.frames.value_or(example->video.frames);
+
+			Samples samples;
+			try
+			{
+				if(!example)
+					throw std::runtime_error(error);
+				for(int i=0; i<options.iterations; i++)
+					runExample(backend, width, height, *example, texture, options, i, samples);
+				result["stages"] = summarize(samples);
+			}
+			catch(const std::exception& e)
+			{
+				std::cerr << "Example " << result["example"].get<std::string>() << " failed: " << e.what() << std::endl;
+				result["error"] = e.what();
+			}
+			report["results"].push_back(result);
+		}
+	}
+
+	std::cout.rdbuf(stdoutBuffer);
+	if(options.output)
+	{
+		std::ofstream file(*options.output);
+		file << report.dump(4) << std::endl;
+	}
+	else
+	{
+		std::cout << report.dump(4) << std::endl;
+	}
+	return 0;
+}
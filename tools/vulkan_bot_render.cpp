@@ -0,0 +1,289 @@
+// Renders a directory of shader messages (like the ones under examples/) to PNG and MP4 files, using every render context and core.
+//
+// vulkan_bot_render --input DIR --output DIR --texture PNG [--resolution WxH] [--contexts N] [--workers N]
+//                   [--shaders DIR] [--shader-include DIR] [--compression fast|default|max] [--max-frames N] [--images]
+//
+// Messages with an "animated" line become videos (unless --images is given), all others still images.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <latch>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <av.h>
+#include <avutils.h>
+#include <lodepng.h>
+
+#include "job_scheduler.h"
+#include "png_encoder.h"
+#include "shader_parser.h"
+#include "video_encoder.h"
+#include "vulkan_backend.h"
+
+using namespace vulkanbot;
+
+struct Options {
+	std::optional<std::filesystem::path> input;
+	std::optional<std::filesystem::path> output;
+	std::optional<std::filesystem::path> texture;
+	std::filesystem::path shaders = "shaders";
+	std::filesystem::path shaderInclude = "shader_include";
+	int width = 1024;
+	int height = 1024;
+	int contexts = 2;
+	unsigned int workers = std::max(std::thread::hardware_concurrency(), 1u);
+	PngCompression compression = PngCompression::Default;
+	int maxFrames = 1000;
+	long bitrate = 1000000;
+	bool images = false;
+};
+
+struct Job {
+	std::filesystem::path path;
+	std::string name;
+	shader vert{.data = "base", .type = shader_type::vert, .file = true};
+	shader frag{.data = "base", .type = shader_type::frag, .file = true};
+	std::optional<animation> video;
+};
+
+static std::optional<Job> loadJob(const std::filesystem::path& path, const Options& options, std::string& error)
+{
+	std::ifstream file(path);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	std::string message = buffer.str();
+
+	Job job;
+	job.path = path;
+	job.name = std::filesystem::relative(path, *options.input).replace_extension().string();
+
+	std::vector<shader> shaders = find_shaders(message, shader_type::frag);
+	if(shaders.empty())
+	{
+		error = "no shaders found";
+		return std::nullopt;
+	}
+	for(const shader& s : shaders)
+	{
+		if(s.type == shader_type::vert)
+			job.vert = s;
+		else if(s.type == shader_type::frag)
+			job.frag = s;
+		else
+		{
+			error = "only vertex and fragment shaders are supported";
+			return std::nullopt;
+		}
+	}
+
+	if(!options.images)
+	{
+		job.video = find_animation(message);
+		if(job.video)
+		{
+			job.video->frames = std::min(job.video->frames, options.maxFrames);
+			if(job.video->bitrate <= 0)
+				job.video->bitrate = options.bitrate;
+		}
+	}
+	return job;
+}
+
+static void render(VulkanBackend& backend, const ImageData& texture, const Job& job, const Options& options, unsigned int encoderThreads)
+{
+	PipelineResult pipeline = backend.createShaderMixPipeline(job.vert.data, job.vert.file, job.frag.data, job.frag.file,
+		vk::CullModeFlagBits::eFront, true);
+	if(!pipeline.success)
+		throw std::runtime_error(pipeline.error);
+
+	std::filesystem::path output = *options.output / job.name;
+	std::filesystem::create_directories(output.parent_path());
+
+	std::shared_ptr<RenderContext> context = backend.acquireContext();
+	context->usePipeline(std::move(pipeline.pipeline), pipeline.fullscreen);
+	context->bindImage(texture);
+	context->buildCommandBuffer(nullptr, job.video ? FrameFormat::YUV420P : FrameFormat::RGBA);
+
+	if(job.video)
+	{
+		const animation& video = *job.video;
+		output += ".mp4";
+
+		VideoEncoder encoder(output.string(), options.width, options.height, video.fps, video.bitrate, encoderThreads);
+		context->renderFrames(video.frames, [&video](int i, UniformBufferObject* ubo){
+			ubo->time = ((video.tEnd-video.tStart)/video.frames)*i + video.tStart;
+			ubo->random = 0.5f;
+		}, [&encoder](int i, std::shared_ptr<uint8_t> data, vk::DeviceSize size, int width, int height, vk::Result result, long time,
+			const GpuTimings& timings){
+			encoder.encode(i, std::move(data), size);
+		});
+		encoder.finish();
+		return;
+	}
+
+	// copy the frame out, so the context can go to the next job while we encode
+	std::vector<uint8_t> pixels;
+	context->setUniformObject({.time = 0.0f, .random = 0.5f});
+	context->renderFrame([&pixels](uint8_t* data, vk::DeviceSize size, int width, int height, vk::Result result, long time, const GpuTimings& timings){
+		pixels.assign(data, data + size);
+	});
+	context.reset();
+
+	output += ".png";
+	std::string png = encodePng(pixels.data(), options.width, options.height, options.compression, encoderThreads);
+	std::ofstream file(output, std::ios::binary);
+	file.write(png.data(), png.size());
+	if(!file)
+		throw std::runtime_error("cannot write " + output.string());
+}
+
+static void usage(const char* name)
+{
+	std::cerr << "Usage: " << name << " --input DIR --output DIR --texture PNG [--resolution WxH] [--contexts N] [--workers N]"
+		" [--shaders DIR] [--shader-include DIR] [--compression fast|default|max] [--max-frames N] [--images]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for(int i=1; i<argc; i++)
+	{
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string {
+			if(i + 1 >= argc)
+			{
+				usage(argv[0]);
+				exit(2);
+			}
+			return argv[++i];
+		};
+
+		if(arg == "--input")
+			options.input = value();
+		else if(arg == "--output")
+			options.output = value();
+		else if(arg == "--texture")
+			options.texture = value();
+		else if(arg == "--shaders")
+			options.shaders = value();
+		else if(arg == "--shader-include")
+			options.shaderInclude = value();
+		else if(arg == "--resolution")
+		{
+			std::string s = value();
+			char x = 0;
+			std::istringstream stream(s);
+			if(!(stream >> options.width >> x >> options.height) || x != 'x' || options.width <= 0 || options.height <= 0 ||
+				options.width % 2 || options.height % 2)
+			{
+				std::cerr << "Invalid resolution " << s << ", expected an even WIDTHxHEIGHT" << std::endl;
+				return 2;
+			}
+		}
+		else if(arg == "--contexts")
+			options.contexts = std::max(std::stoi(value()), 1);
+		else if(arg == "--workers")
+			options.workers = std::max(std::stoi(value()), 1);
+		else if(arg == "--compression")
+		{
+			std::string s = value();
+			std::optional<PngCompression> compression = parsePngCompression(s);
+			if(!compression)
+			{
+				std::cerr << "Unknown compression " << s << std::endl;
+				return 2;
+			}
+			options.compression = *compression;
+		}
+		else if(arg == "--max-frames")
+			options.maxFrames = std::max(std::stoi(value()), 1);
+		else if(arg == "--images")
+			options.images = true;
+		else
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(!options.input || !options.output || !options.texture)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	std::vector<unsigned char> pixels;
+	unsigned int textureWidth, textureHeight;
+	if(unsigned int error = lodepng::decode(pixels, textureWidth, textureHeight, options.texture->string()))
+	{
+		std::cerr << "Failed to decode texture " << *options.texture << ": " << lodepng_error_text(error) << std::endl;
+		return 1;
+	}
+
+	std::vector<Job> jobs;
+	for(const auto& entry : std::filesystem::recursive_directory_iterator(*options.input))
+	{
+		if(!entry.is_regular_file() || entry.path().extension() != ".txt")
+			continue;
+
+		std::string error;
+		if(std::optional<Job> job = loadJob(entry.path(), options, error))
+			jobs.push_back(std::move(*job));
+		else
+			std::cerr << "Skipping " << entry.path() << ": " << error << std::endl;
+	}
+	std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b){ return a.name < b.name; });
+
+	av::init();
+	av::setFFmpegLoggingLevel(AV_LOG_ERROR);
+
+	VulkanBackend backend;
+	backend.initVulkan(options.width, options.height, options.contexts, 3, 4, options.shaders, options.shaderInclude);
+
+	// every job samples the same texture, so it only has to be uploaded once
+	std::unique_ptr<ImageData> texture = backend.acquireContext()->uploadImage(textureWidth, textureHeight, pixels);
+
+	// the PNG and video encoders are multi-threaded themselves, share the cores between the jobs that encode at the same time
+	unsigned int encoderThreads = std::max(std::thread::hardware_concurrency() / options.workers, 1u);
+
+	std::atomic_size_t failed = 0;
+	std::latch done(jobs.size());
+	auto t1 = std::chrono::high_resolution_clock::now();
+	{
+		JobScheduler scheduler(options.workers, jobs.size());
+		for(const Job& job : jobs)
+		{
+			scheduler.submit(job.video ? JobPriority::Low : JobPriority::High, [&](){
+				auto start = std::chrono::high_resolution_clock::now();
+				try
+				{
+					render(backend, *texture, job, options, encoderThreads);
+					auto end = std::chrono::high_resolution_clock::now();
+					std::cerr << "Rendered " << job.name << " in "
+						<< std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+				}
+				catch(const std::exception& e)
+				{
+					std::cerr << "Failed to render " << job.name << ": " << e.what() << std::endl;
+					failed++;
+				}
+				done.count_down();
+			});
+		}
+		done.wait();
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	double seconds = std::chrono::duration<double>(t2 - t1).count();
+	std::cout << "Rendered " << (jobs.size() - failed) << " of " << jobs.size() << " jobs in " << seconds << " s ("
+		<< (seconds > 0 ? jobs.size() / seconds : 0.0) << " jobs/s) on " << backend.contextCount() << " contexts and "
+		<< options.workers << " workers" << std::endl;
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,473 @@
+// Plays a stream of interactions against a VulkanBot through a local stand-in for Discord, and reports how long they queued and
+// how many the bot got through per second.
+//
+// vulkan_bot_replay --config FILE (--input JSONL | --examples DIR) [--rate N] [--burst N] [--count N] [--speed X]
+//                   [--avatar PNG] [--http-latency MS] [--users N] [--save DIR] [--output FILE] [--metrics FILE]
+//
+// --input replays a recording made with "debug": {"record": PATH} at its original pace, scaled by --speed, unless --rate is given.
+// --examples sends the messages under DIR round robin, as "render video" if they have an "animated" line, at --rate per second.
+// --burst N sends N interactions at once, with the bursts spaced so that the average stays at --rate.
+// Every texture URL is answered with --avatar (or a generated image) after --http-latency, "file://" URLs with the file.
+// The JSON report goes to --output or stdout, everything the bot logs goes to stderr.
+// --metrics writes the bot's per-stage histograms and counters at the end, in the format of its metrics endpoint.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "bot.hpp"
+#include "interaction.h"
+#include "interaction_record.h"
+#include "png_encoder.h"
+#include "shader_parser.h"
+
+using namespace vulkanbot;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+	std::optional<std::filesystem::path> config;
+	std::optional<std::filesystem::path> input;
+	std::optional<std::filesystem::path> examples;
+	std::optional<double> rate;
+	size_t burst = 1;
+	std::optional<size_t> count;
+	double speed = 1.0;
+	std::optional<std::filesystem::path> avatar;
+	int httpLatency = 0;
+	size_t users = 16;
+	std::optional<std::filesystem::path> save;
+	std::optional<std::filesystem::path> output;
+	std::optional<std::filesystem::path> metrics;
+};
+
+// what happened to one interaction, times in seconds since the replay started
+struct Trace {
+	std::string command;
+	double submitted = -1.0;
+	double started = -1.0;
+	double finished = -1.0;
+	bool rejected = false;
+	bool failed = false;
+	std::string response;
+	size_t attachmentBytes = 0;
+};
+
+// Collects the responses of all interactions, in place of the Discord API.
+class Sink
+{
+	public:
+		Sink(size_t count, std::optional<std::filesystem::path> save) : m_traces(count), m_save(std::move(save))
+		{
+			if(m_save)
+				std::filesystem::create_directories(*m_save);
+		}
+
+		double now() const
+		{
+			return std::chrono::duration<double>(Clock::now() - m_start).count();
+		}
+
+		void submitted(size_t index, const std::string& command)
+		{
+			std::unique_lock lock(m_mutex);
+			m_traces[index].command = command;
+			m_traces[index].submitted = now();
+		}
+
+		void respond(size_t index, const std::string& content, std::vector<Attachment> attachments, bool last)
+		{
+			std::unique_lock lock(m_mutex);
+			Trace& trace = m_traces[index];
+			trace.response = content;
+			if(content.starts_with("Error"))
+				trace.failed = true;
+			for(const Attachment& a : attachments)
+			{
+				trace.attachmentBytes += a.content.size();
+				if(m_save)
+				{
+					std::ofstream file(*m_save / (std::to_string(index) + "_" + a.name), std::ios::binary);
+					file.write(a.content.data(), a.content.size());
+				}
+			}
+			if(last)
+				complete();
+		}
+
+		void state(size_t index, JobState state)
+		{
+			std::unique_lock lock(m_mutex);
+			Trace& trace = m_traces[index];
+			switch(state)
+			{
+				case JobState::Queued:		break;
+				case JobState::Rejected:	trace.rejected = true; complete(); break;
+				case JobState::Started:		trace.started = now(); break;
+				case JobState::Finished:	trace.finished = now(); complete(); break;
+			}
+		}
+
+		std::vector<Trace> wait()
+		{
+			std::unique_lock lock(m_mutex);
+			m_condition.wait(lock, [this](){ return m_done == m_traces.size(); });
+			return m_traces;
+		}
+
+	private:
+		void complete()
+		{
+			m_done++;
+			m_condition.notify_all();
+		}
+
+		Clock::time_point m_start = Clock::now();
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		std::vector<Trace> m_traces;
+		size_t m_done = 0;
+		std::optional<std::filesystem::path> m_save;
+};
+
+class LocalInteraction : public Interaction
+{
+	public:
+		LocalInteraction(Sink& sink, size_t index, std::optional<animation> video) : m_sink(sink), m_index(index), m_video(video) {}
+
+		// VulkanBot only replies directly to turn a request down
+		void reply(const std::string& content) override
+		{
+			m_sink.respond(m_index, content, {}, true);
+		}
+		void thinking() override {}
+		void edit_response(const std::string& content, std::vector<Attachment> attachments) override
+		{
+			m_sink.respond(m_index, content, std::move(attachments), false);
+		}
+		// answers the dialog right away, with the recorded settings if there are any
+		void ask_animation(const animation& defaults, std::function<void(std::shared_ptr<Interaction>, animation)> answer) override
+		{
+			animation video = m_video.value_or(defaults);
+			answer(std::make_shared<LocalInteraction>(m_sink, m_index, video), video);
+		}
+		void job_state(JobState state) override
+		{
+			m_sink.state(m_index, state);
+		}
+
+	private:
+		Sink& m_sink;
+		size_t m_index;
+		std::optional<animation> m_video;
+};
+
+// Stands in for the Discord CDN.
+class LocalHttpClient : public HttpClient
+{
+	public:
+		LocalHttpClient(std::string avatar, int latency) : m_avatar(std::move(avatar)), m_latency(latency) {}
+
+		std::string get(const std::string& url) override
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_latency));
+			if(url.starts_with("file://"))
+				return readFile(url.substr(7));
+			return m_avatar;
+		}
+
+		static std::string readFile(const std::filesystem::path& path)
+		{
+			std::ifstream file(path, std::ios::binary);
+			std::stringstream buffer;
+			buffer << file.rdbuf();
+			return buffer.str();
+		}
+
+	private:
+		std::string m_avatar;
+		int m_latency;
+};
+
+static std::string defaultAvatar()
+{
+	constexpr uint32_t size = 256;
+	std::vector<uint8_t> pixels(size*size*4);
+	for(uint32_t y=0; y<size; y++)
+	{
+		for(uint32_t x=0; x<size; x++)
+		{
+			uint8_t* pixel = &pixels[(y*size + x)*4];
+			pixel[0] = x;
+			pixel[1] = y;
+			pixel[2] = ((x / 32) + (y / 32)) % 2 ? 255 : 0;
+			pixel[3] = 255;
+		}
+	}
+	return encodePng(pixels.data(), size, size, PngCompression::Fast);
+}
+
+static std::vector<RecordedInteraction> loadRecording(const std::filesystem::path& path)
+{
+	std::ifstream file(path);
+	if(!file)
+		throw std::runtime_error("cannot open " + path.string());
+
+	std::vector<RecordedInteraction> stream;
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(!line.empty())
+			stream.push_back(nlohmann::json::parse(line).get<RecordedInteraction>());
+	}
+	return stream;
+}
+
+static std::vector<RecordedInteraction> loadExamples(const std::filesystem::path& directory, size_t users)
+{
+	std::vector<std::filesystem::path> paths;
+	for(const auto& entry : std::filesystem::recursive_directory_iterator(directory))
+	{
+		if(entry.is_regular_file() && entry.path().extension() == ".txt")
+			paths.push_back(entry.path());
+	}
+	std::sort(paths.begin(), paths.end());
+
+	std::vector<RecordedInteraction> stream;
+	for(const std::filesystem::path& path : paths)
+	{
+		RecordedInteraction interaction;
+		interaction.content = LocalHttpClient::readFile(path);
+		interaction.video = find_animation(interaction.content);
+		interaction.command = interaction.video ? "render video" : "render image";
+		// different URLs with the same pixels, like users that share the default avatar
+		interaction.texture = "https://cdn.local/avatars/" + std::to_string(stream.size() % users) + ".png";
+		stream.push_back(std::move(interaction));
+	}
+	return stream;
+}
+
+// repeats the stream until it has count interactions, or cuts it short
+static std::vector<RecordedInteraction> resize(const std::vector<RecordedInteraction>& stream, size_t count)
+{
+	std::vector<RecordedInteraction> result;
+	double length = stream.back().time - stream.front().time;
+	for(size_t i=0; i<count; i++)
+	{
+		RecordedInteraction interaction = stream[i % stream.size()];
+		interaction.time += (i / stream.size()) * length;
+		result.push_back(std::move(interaction));
+	}
+	return result;
+}
+
+static nlohmann::json summarize(const std::vector<Trace>& traces)
+{
+	std::map<std::string, std::vector<double>> samples;
+	size_t completed = 0, failed = 0, rejected = 0;
+	double first = INFINITY, last = 0.0;
+	for(const Trace& trace : traces)
+	{
+		first = std::min(first, trace.submitted);
+		if(trace.rejected)
+			rejected++;
+		else if(trace.failed)
+			failed++;
+		else if(trace.finished >= 0.0)
+			completed++;
+
+		if(trace.started >= 0.0)
+			samples["queue_wait"].push_back((trace.started - trace.submitted) * 1000.0);
+		if(trace.finished >= 0.0)
+		{
+			samples["service"].push_back((trace.finished - trace.started) * 1000.0);
+			samples["latency"].push_back((trace.finished - trace.submitted) * 1000.0);
+			last = std::max(last, trace.finished);
+		}
+	}
+
+	double duration = last > first ? last - first : 0.0;
+	nlohmann::json summary = {
+		{"interactions", traces.size()},
+		{"completed", completed},
+		{"failed", failed},
+		{"rejected", rejected},
+		{"duration", duration},
+		{"throughput", duration > 0.0 ? completed / duration : 0.0},
+	};
+	for(auto& [name, values] : samples)
+	{
+		std::sort(values.begin(), values.end());
+		// nearest rank
+		auto percentile = [&](double p) {
+			size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+			return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+		};
+		summary[name] = {
+			{"min", values.front()},
+			{"median", percentile(0.5)},
+			{"p99", percentile(0.99)},
+			{"max", values.back()},
+		};
+	}
+	return summary;
+}
+
+static void usage(const char* name)
+{
+	std::cerr << "Usage: " << name << " --config FILE (--input JSONL | --examples DIR) [--rate N] [--burst N] [--count N] [--speed X]"
+		" [--avatar PNG] [--http-latency MS] [--users N] [--save DIR] [--output FILE] [--metrics FILE]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for(int i=1; i<argc; i++)
+	{
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string {
+			if(i + 1 >= argc)
+			{
+				usage(argv[0]);
+				exit(2);
+			}
+			return argv[++i];
+		};
+
+		if(arg == "--config")
+			options.config = value();
+		else if(arg == "--input")
+			options.input = value();
+		else if(arg == "--examples")
+			options.examples = value();
+		else if(arg == "--rate")
+			options.rate = std::stod(value());
+		else if(arg == "--burst")
+			options.burst = std::max(std::stoi(value()), 1);
+		else if(arg == "--count")
+			options.count = std::max(std::stoi(value()), 1);
+		else if(arg == "--speed")
+			options.speed = std::stod(value());
+		else if(arg == "--avatar")
+			options.avatar = value();
+		else if(arg == "--http-latency")
+			options.httpLatency = std::max(std::stoi(value()), 0);
+		else if(arg == "--users")
+			options.users = std::max(std::stoi(value()), 1);
+		else if(arg == "--save")
+			options.save = value();
+		else if(arg == "--output")
+			options.output = value();
+		else if(arg == "--metrics")
+			options.metrics = value();
+		else
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(!options.config || options.input.has_value() == options.examples.has_value() ||
+		(options.rate && *options.rate <= 0.0) || options.speed <= 0.0)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	nlohmann::json config;
+	{
+		std::ifstream file(*options.config);
+		if(!file)
+		{
+			std::cerr << "Could not open config file at " << *options.config << std::endl;
+			return 1;
+		}
+		file >> config;
+	}
+
+	std::vector<RecordedInteraction> stream = options.input ? loadRecording(*options.input) : loadExamples(*options.examples, options.users);
+	if(stream.empty())
+	{
+		std::cerr << "Nothing to replay" << std::endl;
+		return 1;
+	}
+	stream = resize(stream, options.count.value_or(stream.size()));
+
+	// send times relative to the first interaction
+	std::vector<double> times;
+	double rate = options.rate.value_or(1.0);
+	for(size_t i=0; i<stream.size(); i++)
+	{
+		if(options.input && !options.rate)
+			times.push_back((stream[i].time - stream.front().time) / options.speed);
+		else
+			times.push_back((i / options.burst) * options.burst / rate);
+	}
+
+	// the bot logs to stdout, keep it clean for the report
+	std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+	std::string avatar = options.avatar ? LocalHttpClient::readFile(*options.avatar) : defaultAvatar();
+	nlohmann::json report;
+	{
+		// declared before the bot, so it outlives the workers
+		Sink sink(stream.size(), options.save);
+		VulkanBot bot(config, std::make_shared<LocalHttpClient>(std::move(avatar), options.httpLatency));
+
+		auto start = Clock::now();
+		for(size_t i=0; i<stream.size(); i++)
+		{
+			std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(times[i])));
+
+			const RecordedInteraction& interaction = stream[i];
+			sink.submitted(i, interaction.command);
+			bot.handle_command(std::make_shared<LocalInteraction>(sink, i, interaction.video), interaction.command,
+				interaction.content, interaction.texture);
+		}
+		std::vector<Trace> traces = sink.wait();
+
+		report = {
+			{"unit", "ms"},
+			{"rate", options.input && !options.rate ? nlohmann::json() : nlohmann::json(rate)},
+			{"burst", options.burst},
+			{"httpLatency", options.httpLatency},
+			{"total", summarize(traces)},
+			{"commands", nlohmann::json::object()},
+		};
+		std::map<std::string, std::vector<Trace>> commands;
+		for(const Trace& trace : traces)
+			commands[trace.command].push_back(trace);
+		for(const auto& [command, traces] : commands)
+			report["commands"][command] = summarize(traces);
+
+		if(options.metrics)
+		{
+			std::ofstream file(*options.metrics);
+			file << bot.get_metrics().render();
+		}
+	}
+
+	std::cout.rdbuf(stdoutBuffer);
+	if(options.output)
+	{
+		std::ofstream file(*options.output);
+		file << report.dump(4) << std::endl;
+	}
+	else
+	{
+		std::cout << report.dump(4) << std::endl;
+	}
+	return 0;
+}